@@ -123,4 +123,124 @@ typedef struct digi_struct digi_t;
 #define	DIGI_SEDELAY	_IOW('d', 247, int)	/* Get edelay */
 
 
+/************************************************************************
+ * Capture ring control page.  The monitor (/proc/dgrp/mon/ID) and DPA
+ * (/proc/dgrp/dpa/ID) devices can be mmap()ed: the mapping is one page
+ * holding this structure, followed by rg_size bytes of ring data at
+ * offset rg_data.  The driver advances rg_head as it adds data; the
+ * reader consumes from rg_tail up to rg_head and then advances
+ * rg_tail, either itself or through read().
+ ************************************************************************/
+struct ring_ctl {
+	unsigned int	rg_size;		/* Ring data size (2^n) */
+	unsigned int	rg_data;		/* Offset of ring data in mapping */
+	unsigned int	rg_head;		/* Producer offset into ring data */
+	unsigned int	rg_tail;		/* Consumer offset into ring data */
+	unsigned int	rg_drops;		/* Records dropped since open */
+	unsigned int	rg_drop_bytes;		/* Bytes dropped since open */
+};
+
+
+/************************************************************************
+ * Port sets are bitmaps of DIGI_PORTS_MAX bits, one per port on a
+ * server, 32 to an unsigned int.
+ ************************************************************************/
+#define DIGI_PORTS_MAX	64		/* Max # ports per server */
+
+
+/************************************************************************
+ * Monitor filter, for the monitor device.  A reader records only the
+ * MF_* classes it asks for, and only packets that touch its port set.
+ ************************************************************************/
+#define MF_CLIENT	0x0001		/* Packets sent to the server */
+#define MF_SERVER	0x0002		/* Packets received from the server */
+#define MF_MESSAGE	0x0004		/* Messages and connection resets */
+#define MF_MODEM	0x0008		/* Modem signal change messages */
+
+#define MF_DEFAULT	(MF_CLIENT | MF_SERVER | MF_MESSAGE)
+#define MF_ALL		(MF_DEFAULT | MF_MODEM)
+
+struct digi_monfilter {
+	unsigned int	mf_flags;		/* MF_* classes to record */
+	unsigned int	mf_ports[DIGI_PORTS_MAX / 32]; /* Ports to record */
+};
+
+#define DIGI_GETMONFILTER	(('d'<<8) | 240)	/* get monitor filter */
+#define DIGI_SETMONFILTER	(('d'<<8) | 241)	/* set monitor filter */
+
+
+/************************************************************************
+ * Traced port set, for the DPA device.  The drop counters are only
+ * filled in by DIGI_GETDPAPORTS.  With DPA_MODE_TAG each packet type
+ * byte has DPA_TAG set and is followed by the port number.
+ ************************************************************************/
+#define DPA_MODE_STALL	0x0001		/* Flow control traced ports rather
+					 * than drop DPA packets
+					 */
+#define DPA_MODE_TAG	0x0002		/* Tag DPA packets with the port */
+#define DPA_MODE_ALL	(DPA_MODE_STALL | DPA_MODE_TAG)
+
+#define DPA_TAG		0x80		/* Packet type bit: port follows */
+
+struct digi_dpaports {
+	unsigned int	dp_mode;		/* DPA_MODE_* flags */
+	unsigned int	dp_ports[DIGI_PORTS_MAX / 32]; /* Ports to trace */
+	unsigned int	dp_drops;		/* Packets dropped since open */
+	unsigned int	dp_drop_bytes;		/* Bytes dropped since open */
+};
+
+#define DIGI_GETDPAPORTS	(('d'<<8) | 245)	/* get traced ports */
+#define DIGI_SETDPAPORTS	(('d'<<8) | 244)	/* set traced ports */
+
+
+/************************************************************************
+ * Port status snapshot, for the ports device.  sn_ports is the user
+ * address of an array of sn_count digi_portstat entries; the driver
+ * fills in as many as it has (sn_count) and reports how many there
+ * were (sn_total).
+ ************************************************************************/
+struct digi_portstat {
+	unsigned int	ps_node;		/* Node ID, as two characters */
+	unsigned int	ps_port;		/* Port number */
+	unsigned int	ps_node_state;		/* Node state: 1 = up, 0 = down */
+	unsigned int	ps_state;		/* Protocol state */
+	unsigned int	ps_flag;		/* Driver channel flags */
+	unsigned int	ps_tty_open;		/* tty open count */
+	unsigned int	ps_pr_open;		/* Transparent print open count */
+	unsigned int	ps_wait;		/* Opens waiting for the port */
+	unsigned int	ps_mstat;		/* Realport MLAST, 0 if unused */
+	unsigned int	ps_iflag;		/* Realport IFLAG */
+	unsigned int	ps_oflag;		/* Realport OFLAG */
+	unsigned int	ps_cflag;		/* Realport CFLAG */
+	unsigned int	ps_xflag;		/* Realport XFLAG */
+	unsigned int	ps_bps;			/* Baud rate */
+	unsigned int	ps_digi_flags;		/* DIGI_* flags */
+	unsigned int	ps_txq;			/* Bytes waiting to transmit */
+	unsigned int	ps_rxq;			/* Bytes waiting to be read */
+	unsigned int	ps_txcount;		/* Running TX count */
+	unsigned int	ps_rxcount;		/* Running RX count */
+	unsigned int	ps_cts;			/* CTS changes */
+	unsigned int	ps_dsr;			/* DSR changes */
+	unsigned int	ps_rng;			/* RI changes */
+	unsigned int	ps_dcd;			/* DCD changes */
+	unsigned int	ps_frame;		/* Framing errors */
+	unsigned int	ps_parity;		/* Parity errors */
+	unsigned int	ps_brk;			/* Breaks received */
+	unsigned int	ps_overrun;		/* Overruns */
+};
+
+struct digi_portsnap {
+	unsigned int	sn_version;		/* PORTSNAP_VERSION */
+	unsigned int	sn_flags;		/* PORTSNAP_* */
+	unsigned int	sn_count;		/* Entries room/filled */
+	unsigned int	sn_total;		/* Entries available */
+	unsigned long long sn_ports;		/* Array of struct digi_portstat */
+};
+
+#define PORTSNAP_VERSION	1
+#define PORTSNAP_ALL		0x0001	/* Every node, not just this one */
+
+#define DIGI_GETPORTSNAP	(('d'<<8) | 243)	/* get port snapshot */
+
+
 #endif /* _DIGIDRP_H */
@@ -118,6 +118,48 @@ struct digi_debug {
 
 
 
+/*
+ * Set of ports DPA traces, and how.  The port set is a bitmap, one bit
+ * per port.  The drop counters are only filled in by DIGI_GETDPAPORTS.
+ * With DPA_MODE_TAG, each packet type byte read from the DPA device
+ * has DPA_TAG set and is followed by the port number.
+ */
+#define DPA_PORTS_MAX	64	/* Max # ports per server */
+
+#define DPA_MODE_STALL	0x0001	/* Flow control traced ports rather than drop */
+#define DPA_MODE_TAG	0x0002	/* Tag DPA packets with the port */
+#define DPA_MODE_ALL	(DPA_MODE_STALL | DPA_MODE_TAG)
+
+#define DPA_TAG		0x80	/* Packet type bit: port follows */
+
+struct digi_dpaports {
+	uint	dp_mode;		/* DPA_MODE_* flags */
+	uint	dp_ports[DPA_PORTS_MAX / 32]; /* Ports to trace */
+	uint	dp_drops;		/* Packets dropped since open */
+	uint	dp_drop_bytes;		/* Bytes dropped since open */
+};
+
+#define DIGI_GETDPAPORTS  (('d'<<8) | 245)        /* get traced ports      */
+#define DIGI_SETDPAPORTS  (('d'<<8) | 244)        /* set traced ports      */
+
+
+
+/*
+ * Control page at the start of an mmap() of the DPA device.  The
+ * ring data follows at offset rg_data.  The driver advances rg_head;
+ * the reader consumes up to it and then advances rg_tail.
+ */
+struct ring_ctl {
+	uint	rg_size;		/* Ring data size (2^n) */
+	uint	rg_data;		/* Offset of ring data in mapping */
+	uint	rg_head;		/* Producer offset into ring data */
+	uint	rg_tail;		/* Consumer offset into ring data */
+	uint	rg_drops;		/* Records dropped since open */
+	uint	rg_drop_bytes;		/* Bytes dropped since open */
+};
+
+
+
 /*
  * Required functions for each OS that DPA for RealPort supports.
  */
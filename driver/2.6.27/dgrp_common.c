@@ -51,14 +51,24 @@
 #include "linux_ver_fix.h"
 #include <linux/errno.h>
 #include <linux/tty.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 
 #include "dgrp_common.h"
 #include "dgrp_tty.h"
+#include "dgrp_genl.h"
 #include <linux/sched.h>	/* For in_egroup_p() */
 #include <linux/sched/signal.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0)
 #include <linux/slab.h>	/* For in_egroup_p() */
 #endif
+#include <linux/proc_fs.h>
+
+/* Must be the last include: it instantiates the dgrp tracepoints */
+#define CREATE_TRACE_POINTS
+#include "dgrp_trace.h"
 
 
 
@@ -74,6 +84,9 @@ int dgrp_rawreadok;		/* Bypass flipbuf on input */
 int dgrp_register_cudevices;	/* Turn on/off registering legacy cu devices */
 int dgrp_register_prdevices;	/* Turn on/off registering transparent print */
 int dgrp_poll_tick;		/* Poll interval - in ms */
+int dgrp_rwin_autotune;		/* Autotune channel receive windows */
+int dgrp_mon_size;		/* Monitor buffer size for new opens */
+int dgrp_latency;		/* Collect latency histograms */
 
 spinlock_t dgrp_poll_lock;	/* Poll scheduling lock */
 
@@ -365,6 +378,12 @@ void dgrp_carrier(struct ch_struct *ch)
 		}
 	}
 
+	/*
+	 *  Tell event listeners about a change in the virtual carrier.
+	 */
+	if (virt_carrier != ((ch->ch_flag & CH_VIRT_CD) != 0))
+		dgrp_genl_carrier(ch, virt_carrier);
+
 	/*
 	 *  Make sure that our cached values reflect the current reality.
 	 */
@@ -381,6 +400,96 @@ void dgrp_carrier(struct ch_struct *ch)
 } /* dgrp_carrier */
 
 
+/************************************************************************
+ * Allocates a capture ring of "size" bytes (2^n) for the monitor or
+ * DPA device.  The ring data follows a page holding the ring_ctl, and
+ * the memory is suitable for remap_vmalloc_range(), so a capture tool
+ * can mmap() the lot and read records in place.
+ ************************************************************************/
+struct ring_ctl *dgrp_ring_alloc(int size)
+{
+	struct ring_ctl *rg;
+
+	rg = vmalloc_user(PAGE_SIZE + size);
+	if (!rg)
+		return NULL;
+
+	rg->rg_size = size;
+	rg->rg_data = PAGE_SIZE;
+
+	return rg;
+}
+
+
+/************************************************************************
+ * Returns the ring data that follows a capture ring's control page.
+ ************************************************************************/
+uchar *dgrp_ring_data(struct ring_ctl *rg)
+{
+	return (uchar *) rg + PAGE_SIZE;
+}
+
+
+/************************************************************************
+ * Maps a capture ring, control page first, into a user's address
+ * space.  The mapping holds a reference on the file, so the ring
+ * cannot be freed by release() while it is still mapped.
+ ************************************************************************/
+int dgrp_ring_mmap(struct ring_ctl *rg, struct vm_area_struct *vma)
+{
+	if (!rg)
+		return -ENXIO;
+
+	return remap_vmalloc_range(vma, rg, vma->vm_pgoff);
+}
+
+
+/************************************************************************
+ * Frees a capture ring from dgrp_ring_alloc().
+ ************************************************************************/
+void dgrp_ring_free(struct ring_ctl *rg)
+{
+	vfree(rg);
+}
+
+
+/************************************************************************
+ * Returns the time used for latency stamps, in nanoseconds.  Zero
+ * marks a stamp with no interval open, so it is never returned.
+ ************************************************************************/
+u64 dgrp_lat_now(void)
+{
+	u64 now = ktime_to_ns(ktime_get());
+
+	return now ? now : 1;
+}
+
+
+/************************************************************************
+ * Ends the latency interval that began at *stamp, counting it in the
+ * port's and the node's "stage" histograms.  When "more" is set data
+ * is still waiting, and a new interval begins now; otherwise the
+ * stamp is cleared.
+ *
+ * The tty, net and poller paths that stamp a port do not all share a
+ * lock.  A racing update can lose a sample, which is all it costs.
+ ************************************************************************/
+void dgrp_lat_end(struct ch_struct *ch, int stage, u64 *stamp, int more)
+{
+	u64 now = dgrp_lat_now();
+	int n;
+
+	n = fls64(div_u64(now - *stamp, NSEC_PER_USEC));
+	if (n >= LAT_BUCKETS)
+		n = LAT_BUCKETS - 1;
+
+	ch->ch_lat[stage].lh_count[n]++;
+	ch->ch_nd->nd_lat[stage].lh_count[n]++;
+
+	*stamp = more ? now : 0;
+}
+
+
 /****************************************************************************
  *
  *     Describe a set of functions to manipulate both the set of
@@ -411,6 +520,12 @@ void dgrp_carrier(struct ch_struct *ch)
 struct nd_struct *hash_nd_struct[HASHMAX];
 struct nd_struct *head_nd_struct;
 
+/*
+ *  Held to add or delete nodes, and by readers that walk the list
+ *  from process context.
+ */
+struct semaphore nd_struct_semaphore;
+
 /*
  *  ID manipulation macros (where c1 & c2 are unsigned characters, i is
  *  a long integer, and s is a character array of at least three members
@@ -444,6 +559,8 @@ inline void nd_struct_init(void)
 		hash_nd_struct[i] = NULL;
 
 	head_nd_struct = NULL;
+
+	sema_init(&nd_struct_semaphore, 1);
 }
 
 inline void nd_struct_cleanup(void)
@@ -592,7 +709,6 @@ void dgrp_tracef(const char *fmt, ...)
  *
  *****************************************************************************/
 
-#include <linux/proc_fs.h>
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
 struct proc_dir_entry *dgrp_create_proc_entry(const char *name, mode_t mode,
 						struct proc_dir_entry *parent)
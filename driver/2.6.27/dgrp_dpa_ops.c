@@ -55,6 +55,7 @@
 #include <linux/poll.h>
 #include <linux/cred.h>
 #include <linux/sched.h>
+#include <linux/mm.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0)
 #include <linux/slab.h>
 #endif
@@ -68,6 +69,7 @@
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
 static int test_perm(int mode, int op);
 #endif
+static void dgrp_dpa_space(struct nd_struct *nd);
 
 
 /* File operation declarations */
@@ -77,6 +79,7 @@ static ssize_t dgrp_dpa_read(struct file *, char *, size_t, loff_t *);
 static ssize_t dgrp_dpa_write(struct file *, const char *, size_t count, loff_t *);
 static long dgrp_dpa_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
 static unsigned int dgrp_dpa_select(struct file *, struct poll_table_struct *);
+static int dgrp_dpa_mmap(struct file *, struct vm_area_struct *);
 
 
 /* Inode operation declarations */
@@ -93,6 +96,7 @@ static struct file_operations dpa_ops = {
 	.read    =  dgrp_dpa_read,	/* read		*/
 	.write   =  dgrp_dpa_write,	/* write	*/
 	.poll    =  dgrp_dpa_select,	/* poll or select */
+	.mmap    =  dgrp_dpa_mmap,	/* mmap		*/
 	.unlocked_ioctl =  dgrp_dpa_ioctl,	/* ioctl	*/
 	.open    =  dgrp_dpa_open,	/* open		*/
 	.release =  dgrp_dpa_release,	/* release	*/
@@ -333,23 +337,30 @@ static int dgrp_dpa_open(struct inode *inode, struct file *file)
 		goto done;
 	}
 
-	file->private_data = (void *) nd;
-
 	/*
-	 * Allocate the DPA buffer.
+	 * Allocate the DPA buffer.  It comes with a control page and can
+	 * be mmap()ed; see dgrp_dpa_mmap().
 	 */
 
 	if (nd->nd_dpa_buf != 0) {
 		rtn = -EBUSY;
 	} else {
-		nd->nd_dpa_buf = kmalloc(DPA_MAX, GFP_KERNEL);
+		nd->nd_dpa_ctl = dgrp_ring_alloc(DPA_MAX);
 
-		if (nd->nd_dpa_buf == 0) {
+		if (nd->nd_dpa_ctl == 0) {
 			rtn = -ENOMEM;
 		} else {
-			nd->nd_dpa_out = 0;
-			nd->nd_dpa_in = 0;
+			nd->nd_dpa_buf = dgrp_ring_data(nd->nd_dpa_ctl);
 			nd->nd_dpa_lbolt = jiffies;
+			nd->nd_dpa_mode = 0;
+			nd->nd_dpa_drops = 0;
+			nd->nd_dpa_drop_bytes = 0;
+
+			/*
+			 *  Only the opener that owns the buffer may free
+			 *  it on release.
+			 */
+			file->private_data = (void *) nd;
 		}
 	}
 
@@ -388,7 +399,7 @@ done:
 static int dgrp_dpa_release(struct inode *inode, struct file *file)
 {
 	struct nd_struct *nd;
-	uchar *buf;
+	struct ring_ctl *rg;
 	unsigned long lock_flags;
 
 	/*
@@ -406,10 +417,16 @@ static int dgrp_dpa_release(struct inode *inode, struct file *file)
 
 	assert(nd->nd_dpa_buf != 0);
 
-	buf = nd->nd_dpa_buf;
+	rg = nd->nd_dpa_ctl;
 
 	nd->nd_dpa_buf = 0;
-	nd->nd_dpa_out = nd->nd_dpa_in;
+	nd->nd_dpa_ctl = NULL;
+
+	/*
+	 *  Nothing is traced without an analyzer.
+	 */
+	nd->nd_dpa_debug = 0;
+	bitmap_zero(nd->nd_dpa_ports, CHAN_MAX);
 
 	/*
 	 *  Wakeup any thread waiting for buffer space.
@@ -422,7 +439,7 @@ static int dgrp_dpa_release(struct inode *inode, struct file *file)
 
 	DGRP_UNLOCK(nd->nd_dpa_lock, lock_flags);
 
-	kfree(buf);
+	dgrp_ring_free(rg);
 
 done:
 	module_put(THIS_MODULE);
@@ -431,6 +448,25 @@ done:
 }
 
 
+/*
+ *  Wakeup any thread waiting for buffer space, once the consumer has
+ *  brought the buffer back under DPA_HIGH_WATER.  Called with
+ *  nd_dpa_lock held.
+ */
+static void dgrp_dpa_space(struct nd_struct *nd)
+{
+	struct ring_ctl *rg = nd->nd_dpa_ctl;
+	int n;
+
+	n = (rg->rg_head - rg->rg_tail) & DPA_MASK;
+
+	if (nd->nd_dpa_flag & DPA_WAIT_SPACE && (DPA_MAX - n) > DPA_HIGH_WATER) {
+		nd->nd_dpa_flag &= ~DPA_WAIT_SPACE;
+		wake_up_interruptible(&nd->nd_dpa_wqueue);
+	}
+}
+
+
 /*****************************************************************************
 *
 * Function:
@@ -461,10 +497,12 @@ static ssize_t dgrp_dpa_read(struct file *file, char *buf, size_t count, loff_t
 	struct nd_struct *nd;
 	int n;
 	int r;
+	int out;
 	int offset = 0;
 	int res = 0;
 	ssize_t rtn = 0;
 	unsigned long lock_flags;
+	struct ring_ctl *rg;
 
 	/*
 	 *  Get the node pointer, and quit if it doesn't exist.
@@ -475,6 +513,8 @@ static ssize_t dgrp_dpa_read(struct file *file, char *buf, size_t count, loff_t
 		goto done;
 	}
 
+	rg = nd->nd_dpa_ctl;
+
 	/*
 	 *  Wait for some data to appear in the buffer.
 	 */
@@ -482,7 +522,7 @@ static ssize_t dgrp_dpa_read(struct file *file, char *buf, size_t count, loff_t
 	DGRP_LOCK(nd->nd_dpa_lock, lock_flags);
 
 	for (;;) {
-		n = (nd->nd_dpa_in - nd->nd_dpa_out) & DPA_MASK;
+		n = (rg->rg_head - rg->rg_tail) & DPA_MASK;
 
 		if (n != 0)
 			break;
@@ -512,12 +552,13 @@ static ssize_t dgrp_dpa_read(struct file *file, char *buf, size_t count, loff_t
 
 	res = n;
 
-	r = DPA_MAX - nd->nd_dpa_out;
+	out = rg->rg_tail & DPA_MASK;
+	r = DPA_MAX - out;
 
 	if (r <= n) {
 
 		DGRP_UNLOCK(nd->nd_dpa_lock, lock_flags);
-		rtn = copy_to_user(buf, nd->nd_dpa_buf + nd->nd_dpa_out, r);
+		rtn = copy_to_user(buf, nd->nd_dpa_buf + out, r);
 		DGRP_LOCK(nd->nd_dpa_lock, lock_flags);
 
 		if (rtn) {
@@ -526,13 +567,13 @@ static ssize_t dgrp_dpa_read(struct file *file, char *buf, size_t count, loff_t
 			goto done;
 		}
 
-		nd->nd_dpa_out = 0;
+		out = 0;
 		n -= r;
 		offset = r;
 	}
 
 	DGRP_UNLOCK(nd->nd_dpa_lock, lock_flags);
-	rtn = copy_to_user(buf + offset, nd->nd_dpa_buf + nd->nd_dpa_out, n);
+	rtn = copy_to_user(buf + offset, nd->nd_dpa_buf + out, n);
 	DGRP_LOCK(nd->nd_dpa_lock, lock_flags);
 
 	if (rtn) {
@@ -541,7 +582,7 @@ static ssize_t dgrp_dpa_read(struct file *file, char *buf, size_t count, loff_t
 		goto done;
 	}
 
-	nd->nd_dpa_out += n;
+	rg->rg_tail = out + n;
 
 	*ppos += res;
 
@@ -551,12 +592,7 @@ static ssize_t dgrp_dpa_read(struct file *file, char *buf, size_t count, loff_t
 	 *  Wakeup any thread waiting for buffer space.
 	 */
 
-	n = (nd->nd_dpa_in - nd->nd_dpa_out) & DPA_MASK;
-
-	if (nd->nd_dpa_flag & DPA_WAIT_SPACE && (DPA_MAX - n) > DPA_HIGH_WATER) {
-		nd->nd_dpa_flag &= ~DPA_WAIT_SPACE;
-		wake_up_interruptible(&nd->nd_dpa_wqueue);
-	}
+	dgrp_dpa_space(nd);
 
 	DGRP_UNLOCK(nd->nd_dpa_lock, lock_flags);
 
@@ -600,9 +636,30 @@ static unsigned int dgrp_dpa_select(struct file *file, struct poll_table_struct
 {
 	unsigned int retval = 0;
 	struct nd_struct *nd = file->private_data;
+	struct ring_ctl *rg;
+	unsigned long lock_flags;
+
+	if (!nd)
+		return POLLERR;
 
-	if (nd->nd_dpa_out != nd->nd_dpa_in)
+	rg = nd->nd_dpa_ctl;
+
+	poll_wait(file, &nd->nd_dpa_wqueue, table);
+
+	DGRP_LOCK(nd->nd_dpa_lock, lock_flags);
+
+	/*
+	 *  A consumer using mmap() advances rg_tail itself, so this is
+	 *  where the space it freed is handed back.
+	 */
+	dgrp_dpa_space(nd);
+
+	if (((rg->rg_head - rg->rg_tail) & DPA_MASK) != 0)
 		retval |= POLLIN | POLLRDNORM; /* Conditionally readable */
+	else
+		nd->nd_dpa_flag |= DPA_WAIT_DATA;
+
+	DGRP_UNLOCK(nd->nd_dpa_lock, lock_flags);
 
 	retval |= POLLOUT | POLLWRNORM;        /* Always writeable */
 
@@ -610,6 +667,45 @@ static unsigned int dgrp_dpa_select(struct file *file, struct poll_table_struct
 }
 
 
+/*****************************************************************************
+*
+* Function:
+*
+*    dgrp_dpa_mmap
+*
+* Author:
+*
+*    James A. Puzzo
+*
+* Parameters:
+*
+*    file -- file structure of the DPA device
+*    vma  -- user mapping to fill
+*
+* Return Values:
+*
+*    0 on success, else a negative errno
+*
+* Description:
+*
+*    Maps the DPA buffer into user space: a struct ring_ctl page, then
+*    DPA_MAX bytes of DPA packets.  The consumer takes data from rg_tail
+*    up to rg_head, stores the new rg_tail, and calls poll() to wait for
+*    more; poll() is also where the freed space is handed back.
+*
+******************************************************************************/
+
+static int dgrp_dpa_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct nd_struct *nd = file->private_data;
+
+	if (!nd)
+		return -ENXIO;
+
+	return dgrp_ring_mmap(nd->nd_dpa_ctl, vma);
+}
+
+
 
 
 /*****************************************************************************
@@ -640,6 +736,8 @@ static long dgrp_dpa_ioctl(struct file *file, unsigned int cmd, unsigned long ar
 
 	struct nd_struct  *nd;
 	void __user *uarg = (void __user *) arg;
+	unsigned long lock_flags;
+	int i;
 
 	nd = file->private_data;
 
@@ -702,8 +800,79 @@ static long dgrp_dpa_ioctl(struct file *file, unsigned int cmd, unsigned long ar
 			if (copy_from_user(&setdebug, uarg, sizeof(struct digi_debug)))
 				return -EFAULT;
 
+			/*
+			 *  The old single port interface: trace just this
+			 *  port, with untagged packets.
+			 */
+			DGRP_LOCK(nd->nd_dpa_lock, lock_flags);
+
+			bitmap_zero(nd->nd_dpa_ports, CHAN_MAX);
+			if (setdebug.port >= 0 && setdebug.port < CHAN_MAX)
+				__set_bit(setdebug.port, nd->nd_dpa_ports);
+
+			nd->nd_dpa_mode &= ~DPA_MODE_TAG;
 			nd->nd_dpa_debug = setdebug.onoff;
-			nd->nd_dpa_port = setdebug.port;
+
+			DGRP_UNLOCK(nd->nd_dpa_lock, lock_flags);
+		}
+		break;
+
+
+	case DIGI_GETDPAPORTS:
+		{
+			struct digi_dpaports dp;
+
+			memset(&dp, 0, sizeof(dp));
+
+			DGRP_LOCK(nd->nd_dpa_lock, lock_flags);
+
+			dp.dp_mode = nd->nd_dpa_mode;
+			if (nd->nd_dpa_debug)
+				for (i = 0; i < CHAN_MAX; i++)
+					if (test_bit(i, nd->nd_dpa_ports))
+						dp.dp_ports[i / 32] |= 1U << (i % 32);
+			dp.dp_drops = nd->nd_dpa_drops;
+			dp.dp_drop_bytes = nd->nd_dpa_drop_bytes;
+
+			DGRP_UNLOCK(nd->nd_dpa_lock, lock_flags);
+
+			if (copy_to_user(uarg, &dp, sizeof(dp)))
+				return -EFAULT;
+		}
+		break;
+
+
+	case DIGI_SETDPAPORTS:
+		{
+			struct digi_dpaports dp;
+
+			if (copy_from_user(&dp, uarg, sizeof(dp)))
+				return -EFAULT;
+
+			if (dp.dp_mode & ~DPA_MODE_ALL)
+				return -EINVAL;
+
+			DGRP_LOCK(nd->nd_dpa_lock, lock_flags);
+
+			bitmap_zero(nd->nd_dpa_ports, CHAN_MAX);
+			for (i = 0; i < CHAN_MAX; i++)
+				if (dp.dp_ports[i / 32] & (1U << (i % 32)))
+					__set_bit(i, nd->nd_dpa_ports);
+
+			nd->nd_dpa_mode = dp.dp_mode;
+			nd->nd_dpa_debug = !bitmap_empty(nd->nd_dpa_ports, CHAN_MAX);
+
+			/*
+			 *  Leaving DPA_MODE_STALL must not leave a port
+			 *  flow controlled.
+			 */
+			if ((nd->nd_dpa_mode & DPA_MODE_STALL) == 0 &&
+			    (nd->nd_dpa_flag & DPA_WAIT_SPACE)) {
+				nd->nd_dpa_flag &= ~DPA_WAIT_SPACE;
+				wake_up_interruptible(&nd->nd_dpa_wqueue);
+			}
+
+			DGRP_UNLOCK(nd->nd_dpa_lock, lock_flags);
 		}
 		break;
 
@@ -805,44 +974,43 @@ static int test_perm(int mode, int op)
 *
 * Description:
 *
-*    Called by the net device routines to send data to the device
-*    monitor queue.  If the device monitor buffer is too full to
-*    accept the data, it waits until the buffer is ready.
+*    Called by dgrp_dpa_data(), with nd_dpa_lock held, to add data to
+*    the DPA queue.  In DPA_MODE_STALL, once the buffer passes
+*    DPA_HIGH_WATER the traced ports are flow controlled until the
+*    analyzer catches up.
 *
 ******************************************************************************/
 
 static void dgrp_dpa(struct nd_struct *nd, uchar *buf, int nbuf)
 {
+	struct ring_ctl *rg;
 	int n;
 	int r;
-	unsigned long lock_flags;
-
-	/*
-	 *  Grab DPA lock.
-	 */
-	DGRP_LOCK(nd->nd_dpa_lock, lock_flags);
+	int in;
 
 	/*
 	 *  Loop while data remains.
 	 */
 	while (nbuf > 0 && nd->nd_dpa_buf != 0) {
 
-		n = (nd->nd_dpa_out - nd->nd_dpa_in - 1) & DPA_MASK;
+		rg = nd->nd_dpa_ctl;
+		in = rg->rg_head & DPA_MASK;
+
+		n = (rg->rg_tail - in - 1) & DPA_MASK;
 
 		/*
 		 * Enforce flow control on the DPA device.
 		 */
-		if (n < (DPA_MAX - DPA_HIGH_WATER))
+		if ((nd->nd_dpa_mode & DPA_MODE_STALL) &&
+		    n < (DPA_MAX - DPA_HIGH_WATER))
 			nd->nd_dpa_flag |= DPA_WAIT_SPACE;
 
 		/*
 		 * This should never happen, as the flow control above
 		 * should have stopped things before they got to this point.
 		 */
-		if (n == 0) {
-			DGRP_UNLOCK(nd->nd_dpa_lock, lock_flags);
+		if (n == 0)
 			return;
-		}
 
 		/*
 		 * Copy as much data as will fit.
@@ -851,27 +1019,34 @@ static void dgrp_dpa(struct nd_struct *nd, uchar *buf, int nbuf)
 		if (n > nbuf)
 			n = nbuf;
 
-		r = DPA_MAX - nd->nd_dpa_in;
+		r = DPA_MAX - in;
 
 		if (r <= n) {
-			memcpy(nd->nd_dpa_buf + nd->nd_dpa_in, buf, r);
+			memcpy(nd->nd_dpa_buf + in, buf, r);
 
 			n -= r;
 
-			nd->nd_dpa_in = 0;
+			in = 0;
 
 			buf += r;
 			nbuf -= r;
 		}
 
-		memcpy(nd->nd_dpa_buf + nd->nd_dpa_in, buf, n);
+		memcpy(nd->nd_dpa_buf + in, buf, n);
 
-		nd->nd_dpa_in += n;
+		in += n;
 
 		buf += n;
 		nbuf -= n;
 
-		assert(nd->nd_dpa_in < DPA_MAX);
+		assert(in < DPA_MAX);
+
+		/*
+		 *  A mmap()ed consumer reads rg_head without the lock,
+		 *  so the data must be visible before the index moves.
+		 */
+		smp_wmb();
+		rg->rg_head = in;
 
 		/*
 		 *  Wakeup any thread waiting for data
@@ -881,11 +1056,6 @@ static void dgrp_dpa(struct nd_struct *nd, uchar *buf, int nbuf)
 			wake_up_interruptible(&nd->nd_dpa_wqueue);
 		}
 	}
-
-	/*
-	 *  Release the DPA lock.
-	 */
-	DGRP_UNLOCK(nd->nd_dpa_lock, lock_flags);
 }
 
 
@@ -895,7 +1065,7 @@ static void dgrp_dpa(struct nd_struct *nd, uchar *buf, int nbuf)
 *
 * Function:
 *
-*    dgrp_monitor_data
+*    dgrp_dpa_data
 *
 * Author:
 *
@@ -904,6 +1074,7 @@ static void dgrp_dpa(struct nd_struct *nd, uchar *buf, int nbuf)
 * Parameters:
 *
 *    nd   -- pointer to a node structure
+*    port -- port the data belongs to
 *    type -- type of message to be logged in the DPA buffer
 *    buf  -- buffer of data to be logged in the DPA buffer
 *    size -- number of bytes in the "buf" buffer
@@ -914,19 +1085,51 @@ static void dgrp_dpa(struct nd_struct *nd, uchar *buf, int nbuf)
 *
 * Description:
 *
-*    Builds a DPA data packet.
+*    Builds a DPA data packet.  In DPA_MODE_TAG the type carries DPA_TAG
+*    and a 2-byte port number follows the size.  Unless the analyzer
+*    asked for DPA_MODE_STALL, a packet that does not fit is dropped
+*    whole and counted, so tracing never changes a port's timing.
 *
 ******************************************************************************/
 
-void dgrp_dpa_data(struct nd_struct *nd, int type, uchar *buf, int size)
+void dgrp_dpa_data(struct nd_struct *nd, int port, int type, uchar *buf, int size)
 {
-	uchar header[5];
+	struct ring_ctl *rg;
+	uchar header[7];
+	int nhdr = 5;
+	unsigned long lock_flags;
 
 	header[0] = type;
 
 	dgrp_encode_u4(header + 1, size);
 
-	dgrp_dpa(nd, header, sizeof(header));
+	DGRP_LOCK(nd->nd_dpa_lock, lock_flags);
+
+	rg = nd->nd_dpa_ctl;
+
+	if (rg == NULL)
+		goto done;
+
+	if (nd->nd_dpa_mode & DPA_MODE_TAG) {
+		header[0] |= DPA_TAG;
+		dgrp_encode_u2(header + 5, port);
+		nhdr = 7;
+	}
+
+	if ((nd->nd_dpa_mode & DPA_MODE_STALL) == 0 &&
+	    nhdr + size > ((rg->rg_tail - rg->rg_head - 1) & DPA_MASK)) {
+		nd->nd_dpa_drops++;
+		nd->nd_dpa_drop_bytes += nhdr + size;
+
+		rg->rg_drops = nd->nd_dpa_drops;
+		rg->rg_drop_bytes = nd->nd_dpa_drop_bytes;
+		goto done;
+	}
+
+	dgrp_dpa(nd, header, nhdr);
 	dgrp_dpa(nd, buf, size);
+
+done:
+	DGRP_UNLOCK(nd->nd_dpa_lock, lock_flags);
 }
 
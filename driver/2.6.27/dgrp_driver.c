@@ -47,6 +47,7 @@
 #include "dgrp_proc.h"
 #include "dgrp_net_ops.h"
 #include "dgrp_sysfs.h"
+#include "dgrp_genl.h"
 
 static char *version = DIGI_VERSION;
 
@@ -82,6 +83,9 @@ int rawreadok=0;
 #endif
 PARM_INT(register_cudevices,	1,	0644,	"Turn on/off registering legacy cu devices");
 PARM_INT(register_prdevices,	1,	0644,	"Turn on/off registering transparent print devices");
+PARM_INT(rwin_autotune,		1,	0644,	"Turn on/off receive window autotuning");
+PARM_INT(mon_size,		MON_MAX, 0644,	"Monitor buffer size in bytes");
+PARM_INT(latency,		0,	0644,	"Turn on/off latency histograms");
 PARM_INT(net_debug,		0,	0644,	"Turn on/off net debugging");
 PARM_INT(mon_debug,		0,	0644,	"Turn on/off mon debugging");
 PARM_INT(comm_debug,		0,	0644,	"Turn on/off comm debugging");
@@ -122,6 +126,9 @@ static int dgrp_start(void)
 	GLBL(rawreadok) = rawreadok;
 	GLBL(register_cudevices) = register_cudevices;
 	GLBL(register_prdevices) = register_prdevices;
+	GLBL(rwin_autotune) = rwin_autotune;
+	GLBL(mon_size) = mon_size;
+	GLBL(latency) = latency;
 	GLBL(net_debug) = net_debug;
 	GLBL(mon_debug) = mon_debug;
 	GLBL(tty_debug) = tty_debug;
@@ -133,7 +140,16 @@ static int dgrp_start(void)
 	  dbg_trace (("%s:%d, dgrp ERROR exit, rc %x\n", __func__, __LINE__, rc));
 	  return rc;
 	}
+
+	/*
+	 *  Carrier, modem and node state events are optional, so carry
+	 *  on without them if the family can't be registered.
+	 */
+	(void) dgrp_genl_init();
+
 	rc = dgrp_proc_register_basic();
+	if (rc)
+		dgrp_genl_uninit();
 
 	return rc;
 }
@@ -171,4 +187,9 @@ dgrp_cleanup_module(void)
 	 *  Free any currently allocated PortServer structures
 	 */
 	nd_struct_cleanup();
+
+	/*
+	 *  Only now is nothing left that can send an event.
+	 */
+	dgrp_genl_uninit();
 }
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2004 Digi International (www.digi.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED; without even the
+ * implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *
+ *      NOTE TO LINUX KERNEL HACKERS:  DO NOT REFORMAT THIS CODE!
+ *
+ *      This is shared code between Digi's CVS archive and the
+ *      Linux Kernel sources.
+ *      Changing the source just for reformatting needlessly breaks
+ *      our CVS diff history.
+ *
+ *      Send any bug fixes/changes to:  Eng.Linux at digi dot com.
+ *      Thank you.
+ *
+ *
+ *  Description:
+ *
+ *     Multicasts carrier, modem signal, node state and port open/close
+ *     events over a generic netlink family, so that supervisors can
+ *     watch many ports without polling sysfs or /proc.
+ */
+
+#include "linux_ver_fix.h"
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <net/genetlink.h>
+
+#include "drp.h"
+#include "dgrp_common.h"
+#include "dgrp_genl.h"
+
+
+/*
+ *  Port events say who is using which line, so from 6.6, where groups
+ *  can carry a capability requirement, listening needs CAP_NET_ADMIN
+ *  in the network namespace's user namespace.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,6,0)
+static const struct genl_multicast_group dgrp_genl_mcgrps[] = {
+	{ .name = DGRP_GENL_MCGRP, .flags = GENL_MCAST_CAP_NET_ADMIN, },
+};
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3,13,0)
+static const struct genl_multicast_group dgrp_genl_mcgrps[] = {
+	{ .name = DGRP_GENL_MCGRP, },
+};
+#else
+static struct genl_multicast_group dgrp_genl_mcgrp = {
+	.name = DGRP_GENL_MCGRP,
+};
+#endif
+
+static struct genl_family dgrp_genl_family = {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,10,0)
+	.id		= GENL_ID_GENERATE,
+#endif
+	.name		= DGRP_GENL_NAME,
+	.version	= DGRP_GENL_VERSION,
+	.maxattr	= DGRP_A_MAX,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
+	.module		= THIS_MODULE,
+	.mcgrps		= dgrp_genl_mcgrps,
+	.n_mcgrps	= ARRAY_SIZE(dgrp_genl_mcgrps),
+#endif
+};
+
+static int dgrp_genl_registered;
+
+
+/*
+ *  Register the family.  Events are a convenience, so a failure here
+ *  is reported but does not stop the driver from loading.
+ */
+int dgrp_genl_init(void)
+{
+	int rc;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
+	rc = genl_register_family(&dgrp_genl_family);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3,13,0)
+	rc = genl_register_family_with_groups(&dgrp_genl_family,
+					      dgrp_genl_mcgrps);
+#else
+	rc = genl_register_family(&dgrp_genl_family);
+	if (!rc) {
+		rc = genl_register_mc_group(&dgrp_genl_family,
+					    &dgrp_genl_mcgrp);
+		if (rc)
+			genl_unregister_family(&dgrp_genl_family);
+	}
+#endif
+	if (rc) {
+		dbg_trace(("generic netlink events unavailable, rc %d\n", rc));
+		return rc;
+	}
+
+	dgrp_genl_registered = 1;
+	return 0;
+}
+
+
+/*
+ *  Called once no node is left (a failed load, or unload after
+ *  nd_struct_cleanup()), so no event can race with clearing
+ *  dgrp_genl_registered.
+ */
+void dgrp_genl_uninit(void)
+{
+	if (!dgrp_genl_registered)
+		return;
+
+	dgrp_genl_registered = 0;
+	genl_unregister_family(&dgrp_genl_family);
+}
+
+
+/*
+ *  Build and multicast one event.  Called from the net and tty paths,
+ *  often with spinlocks held, so nothing here may sleep.  A port of -1
+ *  marks a node event.
+ */
+static void dgrp_genl_event(int cmd, struct nd_struct *nd, int port, int value)
+{
+	struct sk_buff *skb;
+	void *hdr;
+
+	if (!dgrp_genl_registered)
+		return;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
+	if (!genl_has_listeners(&dgrp_genl_family, &init_net, 0))
+		return;
+#endif
+
+	skb = genlmsg_new(4 * nla_total_size(sizeof(u32)), GFP_ATOMIC);
+	if (!skb)
+		return;
+
+	hdr = genlmsg_put(skb, 0, 0, &dgrp_genl_family, 0, cmd);
+	if (!hdr)
+		goto fail;
+
+	if (nla_put_u32(skb, DGRP_A_NODE, nd->nd_ID) ||
+	    nla_put_u32(skb, DGRP_A_MAJOR, nd->nd_major) ||
+	    (port >= 0 && nla_put_u32(skb, DGRP_A_PORT, port)) ||
+	    nla_put_u32(skb, DGRP_A_VALUE, value))
+		goto fail;
+
+	genlmsg_end(skb, hdr);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,13,0)
+	genlmsg_multicast(&dgrp_genl_family, skb, 0, 0, GFP_ATOMIC);
+#else
+	genlmsg_multicast(skb, 0, dgrp_genl_mcgrp.id, GFP_ATOMIC);
+#endif
+	return;
+
+fail:
+	nlmsg_free(skb);
+}
+
+
+void dgrp_genl_carrier(struct ch_struct *ch, int carrier)
+{
+	dgrp_genl_event(DGRP_C_CARRIER, ch->ch_nd, ch->ch_portnum, carrier);
+}
+
+
+void dgrp_genl_modem(struct ch_struct *ch, int mstat)
+{
+	dgrp_genl_event(DGRP_C_MODEM, ch->ch_nd, ch->ch_portnum, mstat);
+}
+
+
+void dgrp_genl_node_state(struct nd_struct *nd)
+{
+	dgrp_genl_event(DGRP_C_NODE_STATE, nd, -1, nd->nd_state);
+}
+
+
+void dgrp_genl_open(struct ch_struct *ch, int error)
+{
+	dgrp_genl_event(DGRP_C_PORT_OPEN, ch->ch_nd, ch->ch_portnum, error);
+}
+
+
+void dgrp_genl_close(struct ch_struct *ch)
+{
+	dgrp_genl_event(DGRP_C_PORT_CLOSE, ch->ch_nd, ch->ch_portnum,
+			ch->ch_open_count);
+}
@@ -57,6 +57,9 @@
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0)
 #include <linux/slab.h>
 #endif
+#include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
 
 #include "drp.h"
 #include "dgrp_common.h"
@@ -75,6 +78,8 @@ static int dgrp_mon_release(struct inode *, struct file *);
 static ssize_t dgrp_mon_read(struct file *, char *, size_t, loff_t *);
 static ssize_t dgrp_mon_write(struct file *, const char *, size_t, loff_t *);
 static long dgrp_mon_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+static unsigned int dgrp_mon_select(struct file *, struct poll_table_struct *);
+static int dgrp_mon_mmap(struct file *, struct vm_area_struct *);
 
 
 /* Inode operation declarations */
@@ -90,6 +95,8 @@ static struct file_operations mon_ops = {
 	.owner   = THIS_MODULE,		/* owner   */
 	.read    = dgrp_mon_read,	/* read	   */
 	.write   = dgrp_mon_write,	/* write   */
+	.poll    = dgrp_mon_select,	/* poll or select */
+	.mmap    = dgrp_mon_mmap,	/* mmap    */
 	.unlocked_ioctl = dgrp_mon_ioctl,	/* ioctl   */
 	.open    = dgrp_mon_open,	/* open    */
 	.release = dgrp_mon_release,	/* release */
@@ -159,8 +166,6 @@ int register_mon_device(struct nd_struct *node, struct proc_dir_entry *root)
 
 	node->nd_mon_de = de;
 
-	sema_init(&node->nd_mon_semaphore, 1);
-
 	return 0;
 }
 
@@ -248,7 +253,9 @@ int unregister_mon_device(struct nd_struct *node, struct proc_dir_entry *root)
 static int dgrp_mon_open(struct inode *inode, struct file *file)
 {
 	struct nd_struct *nd;
+	struct mon_struct *mon;
 	int rtn = 0;
+	int size;
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
 	struct proc_dir_entry *de;
@@ -296,73 +303,101 @@ static int dgrp_mon_open(struct inode *inode, struct file *file)
 		goto done;
 	}
 
-	file->private_data = (void *) nd;
-
 	/*
-	 * Allocate the monitor buffer.
+	 * Allocate this reader and its buffer.  The buffer size is fixed
+	 * for as long as this open lasts.
 	 */
 
-	/*
-	 *  Grab the MON lock.
-	 */
-	down(&nd->nd_mon_semaphore);
+	size = GLBL(mon_size);
+	if (size < MON_MIN)
+		size = MON_MIN;
+	if (size > MON_LIMIT)
+		size = MON_LIMIT;
+	size = roundup_pow_of_two(size);
+	if (size < PAGE_SIZE)
+		size = PAGE_SIZE;
+
+	mon = kzalloc(sizeof(struct mon_struct), GFP_KERNEL);
+	if (!mon) {
+		rtn = -ENOMEM;
+		goto done;
+	}
 
-	if (nd->nd_mon_buf != 0) {
-		rtn = -EBUSY;
-	} else {
-		nd->nd_mon_buf = kmalloc(MON_MAX, GFP_KERNEL);
+	mon->mon_ctl = dgrp_ring_alloc(size);
+	if (!mon->mon_ctl) {
+		kfree(mon);
+		rtn = -ENOMEM;
+		goto done;
+	}
 
-		if (nd->nd_mon_buf == 0) {
-			rtn = -ENOMEM;
-		} else {
-			/*
-			 *  Enter an RPDUMP file header into the buffer.
-			 */
+	mon->mon_buf = dgrp_ring_data(mon->mon_ctl);
+	mon->mon_nd = nd;
+	mon->mon_size = size;
+	mon->mon_flags = MF_DEFAULT;
+	bitmap_fill(mon->mon_ports, CHAN_MAX);
+	sema_init(&mon->mon_semaphore, 1);
+	init_waitqueue_head(&mon->mon_wqueue);
 
-			uchar *buf = nd->nd_mon_buf;
-			uint  time;
-			struct timeval tv;
+	{
+		/*
+		 *  Enter an RPDUMP file header into the buffer.
+		 */
 
-			strcpy(buf, RPDUMP_MAGIC);
-			buf += strlen(buf) + 1;
+		uchar *buf = mon->mon_buf;
+		uint  time;
+		struct timeval tv;
 
-			do_gettimeofday(&tv);
+		strcpy(buf, RPDUMP_MAGIC);
+		buf += strlen(buf) + 1;
 
-			/*
-			 *  tv.tv_sec might be a 64 bit quantity.  Pare
-			 *  it down to 32 bits before attempting to encode
-			 *  it.
-			 */
-			time = (uint) (tv.tv_sec & 0xffffffff);
-
-			dgrp_encode_u4(buf + 0, time);
-			dgrp_encode_u2(buf + 4, 0);
-			buf += 6;
-
-			if (nd->nd_tx_module != 0) {
-				buf[0] = RPDUMP_CLIENT;
-				dgrp_encode_u4(buf + 1, 0);
-				dgrp_encode_u2(buf + 5, 1);
-				buf[7] = 0xf0 + nd->nd_tx_module;
-				buf += 8;
-			}
+		do_gettimeofday(&tv);
 
-			if (nd->nd_rx_module != 0) {
-				buf[0] = RPDUMP_SERVER;
-				dgrp_encode_u4(buf + 1, 0);
-				dgrp_encode_u2(buf + 5, 1);
-				buf[7] = 0xf0 + nd->nd_rx_module;
-				buf += 8;
-			}
+		/*
+		 *  tv.tv_sec might be a 64 bit quantity.  Pare
+		 *  it down to 32 bits before attempting to encode
+		 *  it.
+		 */
+		time = (uint) (tv.tv_sec & 0xffffffff);
 
-			nd->nd_mon_out = 0;
-			nd->nd_mon_in  = buf - nd->nd_mon_buf;
+		dgrp_encode_u4(buf + 0, time);
+		dgrp_encode_u2(buf + 4, 0);
+		buf += 6;
 
-			nd->nd_mon_lbolt = jiffies;
+		/*
+		 *  The net routines only look at the readers with the
+		 *  NET lock held, so set everything up under it before
+		 *  they can see this one.
+		 */
+		down(&nd->nd_net_semaphore);
+
+		if (nd->nd_tx_module != 0) {
+			buf[0] = RPDUMP_CLIENT;
+			dgrp_encode_u4(buf + 1, 0);
+			dgrp_encode_u2(buf + 5, 1);
+			buf[7] = 0xf0 + nd->nd_tx_module;
+			buf += 8;
 		}
+
+		if (nd->nd_rx_module != 0) {
+			buf[0] = RPDUMP_SERVER;
+			dgrp_encode_u4(buf + 1, 0);
+			dgrp_encode_u2(buf + 5, 1);
+			buf[7] = 0xf0 + nd->nd_rx_module;
+			buf += 8;
+		}
+
+		mon->mon_ctl->rg_tail = 0;
+		mon->mon_ctl->rg_head = buf - mon->mon_buf;
+
+		mon->mon_lbolt = jiffies;
+
+		list_add_tail(&mon->mon_list, &nd->nd_mon_list);
+		nd->nd_mon_count++;
+
+		up(&nd->nd_net_semaphore);
 	}
 
-	up(&nd->nd_mon_semaphore);
+	file->private_data = (void *) mon;
 
 done:
 	dbg_mon_trace(OPEN, ("mon open(%p) return %d\n",
@@ -400,51 +435,45 @@ done:
 
 static int dgrp_mon_release(struct inode *inode, struct file *file)
 {
+	struct mon_struct *mon;
 	struct nd_struct *nd;
-	uchar *buf;
+	uchar *stage = NULL;
 
 	dbg_mon_trace(CLOSE, ("mon close(%p) start\n", file->private_data));
 
 	/*
-	 *  Get the node pointer, and quit if it doesn't exist.
+	 *  Get the reader pointer, and quit if it doesn't exist.
 	 */
-	nd = (struct nd_struct *)(file->private_data);
-	if (!nd)
+	mon = (struct mon_struct *)(file->private_data);
+	if (!mon)
 		goto done;
 
+	nd = mon->mon_nd;
+
 	/*
-	 *  Free the monitor buffer.
+	 *  Take the reader off the node.  Taking the NET lock makes sure
+	 *  no thread is in the middle of writing a packet to it.
 	 */
 
-	down(&nd->nd_mon_semaphore);
-
-	assert(nd->nd_mon_buf != 0);
-
-	buf = nd->nd_mon_buf;
-
-	nd->nd_mon_buf = 0;
-	nd->nd_mon_out = nd->nd_mon_in;
+	down(&nd->nd_net_semaphore);
 
-	kfree(buf);
+	list_del(&mon->mon_list);
+	nd->nd_mon_count--;
 
-	/*
-	 *  Wakeup any thread waiting for buffer space.
-	 */
+	if (mon->mon_portsel)
+		nd->nd_mon_portsel--;
 
-	if (nd->nd_mon_flag & MON_WAIT_SPACE) {
-		nd->nd_mon_flag &= ~MON_WAIT_SPACE;
-		wake_up_interruptible(&nd->nd_mon_wqueue);
+	if (nd->nd_mon_portsel == 0) {
+		stage = nd->nd_mon_stage;
+		nd->nd_mon_stage = NULL;
 	}
 
-	up(&nd->nd_mon_semaphore);
-
-	/*
-	 *  Make sure there is no thread in the middle of writing a packet.
-	 */
-
-	down(&nd->nd_net_semaphore);
 	up(&nd->nd_net_semaphore);
 
+	kfree(stage);
+	dgrp_ring_free(mon->mon_ctl);
+	kfree(mon);
+
 	dbg_mon_trace(CLOSE, ("mon close(%p) return\n", file->private_data));
 
 done:
@@ -481,9 +510,12 @@ done:
 
 static ssize_t dgrp_mon_read(struct file *file, char *buf, size_t count, loff_t *ppos)
 {
-	struct nd_struct *nd;
+	struct mon_struct *mon;
+	struct ring_ctl *rg;
 	int n;
 	int r;
+	int out;
+	int mask;
 	int offset = 0;
 	int res = 0;
 	ssize_t rtn = 0;
@@ -491,10 +523,10 @@ static ssize_t dgrp_mon_read(struct file *file, char *buf, size_t count, loff_t
 	dbg_mon_trace(READ, ("mon read (%x)\n", file->private_data));
 
 	/*
-	 *  Get the node pointer, and quit if it doesn't exist.
+	 *  Get the reader pointer, and quit if it doesn't exist.
 	 */
-	nd = (struct nd_struct *)(file->private_data);
-	if (!nd) {
+	mon = (struct mon_struct *)(file->private_data);
+	if (!mon) {
 		rtn = -ENXIO;
 		goto done;
 	}
@@ -503,30 +535,36 @@ static ssize_t dgrp_mon_read(struct file *file, char *buf, size_t count, loff_t
 	 *  Wait for some data to appear in the buffer.
 	 */
 
-	down(&nd->nd_mon_semaphore);
+	down(&mon->mon_semaphore);
+
+	rg = mon->mon_ctl;
+	mask = mon->mon_size - 1;
 
 	for (;;) {
-		n = (nd->nd_mon_in - nd->nd_mon_out) & MON_MASK;
+		n = (rg->rg_head - rg->rg_tail) & mask;
 
 		if (n != 0)
 			break;
 
-		nd->nd_mon_flag |= MON_WAIT_DATA;
-
-		up(&nd->nd_mon_semaphore);
+		up(&mon->mon_semaphore);
 
 		/*
 		 * Go to sleep waiting until the condition becomes true.
 		 */
-		rtn = wait_event_interruptible(nd->nd_mon_wqueue,
-			((nd->nd_mon_flag & MON_WAIT_DATA) == 0));
+		rtn = wait_event_interruptible(mon->mon_wqueue,
+			((rg->rg_head - rg->rg_tail) & mask) != 0);
 
 		if (rtn)
 			goto done;
 
-		down(&nd->nd_mon_semaphore);
+		down(&mon->mon_semaphore);
 	}
 
+	/*
+	 *  Don't look at the data before the producer's pointer.
+	 */
+	smp_rmb();
+
 	/*
 	 *  Read whatever is there.
 	 */
@@ -536,49 +574,45 @@ static ssize_t dgrp_mon_read(struct file *file, char *buf, size_t count, loff_t
 
 	res = n;
 
-	r = MON_MAX - nd->nd_mon_out;
+	out = rg->rg_tail & mask;
+	r = mon->mon_size - out;
 
 	if (r <= n) {
 
-		rtn = copy_to_user(buf, nd->nd_mon_buf + nd->nd_mon_out, r);
+		rtn = copy_to_user(buf, mon->mon_buf + out, r);
 		if (rtn) {
 			rtn = -EFAULT;
-			up(&nd->nd_mon_semaphore);
+			up(&mon->mon_semaphore);
 			goto done;
 		}
 
-		nd->nd_mon_out = 0;
+		out = 0;
 		n -= r;
 		offset = r;
 	}
 
-	rtn = copy_to_user(buf + offset, nd->nd_mon_buf + nd->nd_mon_out, n);
+	rtn = copy_to_user(buf + offset, mon->mon_buf + out, n);
 	if (rtn) {
 		rtn = -EFAULT;
-		up(&nd->nd_mon_semaphore);
+		up(&mon->mon_semaphore);
 		goto done;
 	}
 
-	nd->nd_mon_out += n;
+	/*
+	 *  Hand the space back to the producer only after the copy.
+	 */
+	smp_mb();
+	rg->rg_tail = (out + n) & mask;
 
 	*ppos += res;
 
 	rtn = res;
 
-	up(&nd->nd_mon_semaphore);
-
-	/*
-	 *  Wakeup any thread waiting for buffer space.
-	 */
-
-	if (nd->nd_mon_flag & MON_WAIT_SPACE) {
-		nd->nd_mon_flag &= ~MON_WAIT_SPACE;
-		wake_up_interruptible(&nd->nd_mon_wqueue);
-	}
+	up(&mon->mon_semaphore);
 
  done:
 	dbg_mon_trace(READ, ("mon read (%p) count=%d return %d\n",
-				nd, res, rtn));
+				mon, res, rtn));
 
 	return rtn;
 }
@@ -614,6 +648,88 @@ static ssize_t dgrp_mon_write(struct file *file, const char *buf, size_t count,
 }
 
 
+/*****************************************************************************
+*
+* Function:
+*
+*    dgrp_mon_select
+*
+* Author:
+*
+*    James A. Puzzo
+*
+* Parameters:
+*
+*    file  -- file structure of the monitoring device
+*    table -- poll table to wait on
+*
+* Return Values:
+*
+*    POLLIN | POLLRDNORM when the ring holds data, else 0
+*
+* Description:
+*
+*    Lets a reader, or a capture tool consuming the ring through mmap(),
+*    sleep until the net routines add a record.
+*
+******************************************************************************/
+
+static unsigned int dgrp_mon_select(struct file *file, struct poll_table_struct *table)
+{
+	struct mon_struct *mon = file->private_data;
+	unsigned int retval = 0;
+
+	if (!mon)
+		return POLLERR;
+
+	poll_wait(file, &mon->mon_wqueue, table);
+
+	if (((mon->mon_ctl->rg_head - mon->mon_ctl->rg_tail) & (mon->mon_size - 1)) != 0)
+		retval |= POLLIN | POLLRDNORM;
+
+	return retval;
+}
+
+
+/*****************************************************************************
+*
+* Function:
+*
+*    dgrp_mon_mmap
+*
+* Author:
+*
+*    James A. Puzzo
+*
+* Parameters:
+*
+*    file -- file structure of the monitoring device
+*    vma  -- user mapping to fill
+*
+* Return Values:
+*
+*    0 on success, else a negative errno
+*
+* Description:
+*
+*    Maps the reader's ring into user space: a struct ring_ctl page,
+*    then mon_size bytes of rpdump records.  The consumer takes records
+*    from rg_tail up to rg_head and then stores the new rg_tail; the
+*    net routines never overwrite unconsumed data, they drop instead.
+*
+******************************************************************************/
+
+static int dgrp_mon_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct mon_struct *mon = file->private_data;
+
+	if (!mon)
+		return -ENXIO;
+
+	return dgrp_ring_mmap(mon->mon_ctl, vma);
+}
+
+
 /*****************************************************************************
 *
 * Function:
@@ -626,20 +742,104 @@ static ssize_t dgrp_mon_write(struct file *file, const char *buf, size_t count,
 *
 * Parameters:
 *
-*    inode, file, cmd, arg (standard Linux ioctl arguments)
+*    file, cmd, arg (standard Linux ioctl arguments)
 *
 * Return Values:
 *
-*    -EINVAL
+*    0, -EFAULT, -ENOMEM or -EINVAL
 *
 * Description:
 *
-*    It is always invalid to execute ioctls on the monitoring device
+*    Get or set this reader's filter.  Only records of the chosen
+*    classes are recorded, and packets only if they carry commands or
+*    data for one of the chosen ports.  Messages are not port specific
+*    and pass any port set.
 *
 ******************************************************************************/
 static long dgrp_mon_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
-	return -EINVAL;
+	struct mon_struct *mon = file->private_data;
+	struct nd_struct *nd;
+	void __user *uarg = (void __user *) arg;
+	struct digi_monfilter filter;
+	int i;
+
+	if (!mon)
+		return -ENXIO;
+
+	nd = mon->mon_nd;
+
+	switch (cmd) {
+	case DIGI_GETMONFILTER:
+		memset(&filter, 0, sizeof(filter));
+
+		filter.mf_flags = mon->mon_flags;
+		for (i = 0; i < CHAN_MAX; i++)
+			if (test_bit(i, mon->mon_ports))
+				filter.mf_ports[i / 32] |= 1U << (i % 32);
+
+		if (copy_to_user(uarg, &filter, sizeof(filter)))
+			return -EFAULT;
+		break;
+
+	case DIGI_SETMONFILTER:
+		{
+			DECLARE_BITMAP(ports, CHAN_MAX);
+			uchar *stage = NULL;
+			int portsel;
+
+			if (copy_from_user(&filter, uarg, sizeof(filter)))
+				return -EFAULT;
+
+			if (filter.mf_flags & ~MF_ALL)
+				return -EINVAL;
+
+			bitmap_zero(ports, CHAN_MAX);
+			for (i = 0; i < CHAN_MAX; i++)
+				if (filter.mf_ports[i / 32] & (1U << (i % 32)))
+					__set_bit(i, ports);
+
+			portsel = !bitmap_full(ports, CHAN_MAX);
+
+			/*
+			 *  Port filtering needs server data kept aside
+			 *  until dgrp_receive() has decoded its ports.
+			 */
+			if (portsel) {
+				stage = kmalloc(UIO_MAX, GFP_KERNEL);
+				if (!stage)
+					return -ENOMEM;
+			}
+
+			down(&nd->nd_net_semaphore);
+
+			if (portsel && !nd->nd_mon_stage) {
+				nd->nd_mon_stage = stage;
+				stage = NULL;
+			}
+
+			nd->nd_mon_portsel += portsel - mon->mon_portsel;
+
+			mon->mon_portsel = portsel;
+			mon->mon_flags = filter.mf_flags;
+			bitmap_copy(mon->mon_ports, ports, CHAN_MAX);
+
+			if (nd->nd_mon_portsel == 0) {
+				stage = nd->nd_mon_stage;
+				nd->nd_mon_stage = NULL;
+			}
+
+			up(&nd->nd_net_semaphore);
+
+			kfree(stage);
+		}
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
 }
 
 
@@ -74,6 +74,8 @@
 #include "drp.h"
 #include "dgrp_common.h"
 #include "dgrp_sysfs.h"
+#include "dgrp_genl.h"
+#include "dgrp_trace.h"
 
 
 /*****************************************************************
@@ -104,8 +106,16 @@ static struct timer_list poll_timer;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
 static int test_perm(int mode, int op);
 #endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
 static void   parity_scan(struct ch_struct *ch, unsigned char *cbuf,
 				unsigned char *fbuf, int *len);
+#else
+static int    dgrp_input_scan(struct ch_struct *ch, struct tty_struct *tty,
+				int len);
+#endif
+static void   dgrp_monitor_modem(struct nd_struct *nd, struct ch_struct *ch,
+				 uchar mlast, uchar mstat);
+static void   dgrp_net_state(struct nd_struct *nd, int state);
 
 /*
  *  File operation declarations
@@ -330,6 +340,7 @@ static void dgrp_dump(uchar *mem, int len)
 	}
 }
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
 /*
  *      dgrp_read_data_block:
  *
@@ -374,7 +385,9 @@ dgrp_read_data_block(struct ch_struct *ch, void *flipbuf, int flipbuf_size, int
 
 	return count;
 }
+#endif
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,8,0) && LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
 static void show_flags(struct tty_struct *tty)
 {
 	dbg_net_trace(INPUT, ("show_flags: "
@@ -411,11 +424,12 @@ static void show_flags(struct tty_struct *tty)
 }
 
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,8,0)
 /* After 3.8.0, "real_raw" was moved out of tty_struct and into
  * n_tty.c's private struct n_tty_data.  So... here we make our
  * own raw mode assessment (based on Stevens' Advanced Programming
- * in the UNIX Environment, chapter 18 definition).
+ * in the UNIX Environment, chapter 18 definition).  From 3.9 on
+ * dgrp_input() always goes through the flip buffers and never
+ * needs it.
  */
 static unsigned char
 dgrp_is_real_raw(struct tty_struct *tty)
@@ -440,6 +454,42 @@ dgrp_is_real_raw(struct tty_struct *tty)
 #endif
 
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+/*
+ * Move up to len bytes of rbuf straight into the port's flip buffers
+ * with a fixed TTY_NORMAL flag.  Only used when no input flags would
+ * make parity_scan() produce anything else, so there is no flag
+ * buffer to fill and no copy through nd_inputbuf.  Data the tty layer
+ * has no room for stays in rbuf.  Returns the number of bytes moved.
+ */
+static int dgrp_input_fixed(struct ch_struct *ch, struct tty_struct *tty,
+			    int len)
+{
+	struct nd_struct *nd = ch->ch_nd;
+	int count = 0;
+	int n;
+
+	while (len > 0) {
+		n = min(len, RBUF_MAX - ch->ch_rout);
+
+		n = tty_insert_flip_string_fixed_flag(&ch->port,
+				ch->ch_rbuf + ch->ch_rout, TTY_NORMAL, n);
+		if (n <= 0)
+			break;
+
+		if (DGRP_DPA_TRACED(nd, ch->ch_portnum))
+			dgrp_dpa_data(nd, ch->ch_portnum, 1, ch->ch_rbuf + ch->ch_rout, n);
+
+		ch->ch_rout = (ch->ch_rout + n) & RBUF_MASK;
+		count += n;
+		len -= n;
+	}
+
+	return count;
+}
+#endif
+
+
 /*****************************************************************************
 *
 * Function:
@@ -468,6 +518,10 @@ dgrp_is_real_raw(struct tty_struct *tty)
 *    There are several modes to consider here:
 *    rawreadok, tty->real_raw, and IF_PARMRK
 *
+*    On 3.9 and later kernels, data goes straight from rbuf to the
+*    flip buffers: through dgrp_input_fixed() when none of PARMRK,
+*    BRKINT or INPCK is set, otherwise through dgrp_input_scan().
+*
 ******************************************************************************/
 
 
@@ -475,7 +529,6 @@ static void dgrp_input(struct ch_struct *ch)
 {
 	struct nd_struct *nd;
 	struct tty_struct *tty;
-	int remain;
 	int data_len;
 	int len;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,8,0)
@@ -484,9 +537,11 @@ static void dgrp_input(struct ch_struct *ch)
 	int tty_count;
 	ulong lock_flags;
 	struct tty_ldisc *ld;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
 	uchar  *myflipbuf;
 	uchar  *myflipflagbuf;
 	unsigned char l_real_raw;
+#endif
 
 	if (!ch) {
 		dbg_net_trace(INPUT, ("bogus input channel\n"));
@@ -502,8 +557,10 @@ static void dgrp_input(struct ch_struct *ch)
 
 	DGRP_LOCK(nd->nd_lock, lock_flags);
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
 	myflipbuf = nd->nd_inputbuf;
 	myflipflagbuf = nd->nd_inputflagbuf;
+#endif
 
 	if (!ch->ch_open_count && !(ch->ch_tun).un_blocked_open) {
 		ch->ch_rout = ch->ch_rin;
@@ -552,13 +609,11 @@ static void dgrp_input(struct ch_struct *ch)
 
 	DGRP_UNLOCK(nd->nd_lock, lock_flags);
 
-	dbg_net_trace(INPUT, ("input(%x) start\n", nd->nd_ID));
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,8,0)
 	l_real_raw = tty->real_raw;
-#else
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
 	l_real_raw = dgrp_is_real_raw(tty);
 #endif
-	dbg_net_trace(INPUT, ("dgrp_input l_real_raw:%d\n", l_real_raw));
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,8,0)
 	/* Decide how much data we can send into the tty layer */
@@ -571,7 +626,6 @@ static void dgrp_input(struct ch_struct *ch)
 
 	/* data_len should be the number of chars that we read in */
 	data_len = (ch->ch_rin - ch->ch_rout) & RBUF_MASK;
-	remain = data_len;
 
 	/* len is the amount of data we are going to transfer here */
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,8,0)
@@ -617,25 +671,36 @@ static void dgrp_input(struct ch_struct *ch)
 		}
 	}
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,8,0)
-	dbg_net_trace(INPUT, ("rawreadok(%d) real_raw(%d) flip_len(%d) data_len(%d) len(%d)\n",
-		GLBL(rawreadok), l_real_raw, flip_len, data_len, len));
-#else
-	dbg_net_trace(INPUT, ("rawreadok(%d) real_raw(%d) data_len(%d) len(%d)\n",
-		GLBL(rawreadok), l_real_raw, data_len, len));
-#endif
-
-
-
 	/* Check DPA flow control */
-	if (nd->nd_dpa_debug && nd->nd_dpa_flag & DPA_WAIT_SPACE &&
-		 nd->nd_dpa_port == MINOR(tty_devnum(ch->ch_tun.un_tty))) {
+	if (nd->nd_dpa_flag & DPA_WAIT_SPACE &&
+	    DGRP_DPA_TRACED(nd, ch->ch_portnum)) {
 		len = 0;
 	}
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0)
+	/*
+	 * Move the data straight from rbuf into the flip buffers.
+	 * Nothing is staged in a per-node buffer, so ports do not
+	 * have to be delivered one at a time.
+	 */
+	if (len && !(ch->ch_flag & CH_RXSTOP)) {
+
+		if (I_PARMRK(tty) || I_BRKINT(tty) || I_INPCK(tty))
+			len = dgrp_input_scan(ch, tty, len);
+		else
+			len = dgrp_input_fixed(ch, tty, len);
+
+		/* Tell the tty layer its okay to "eat" the data now */
+		tty_flip_buffer_push(&ch->port);
+
+		ch->ch_rxcount += len;
+
+		if (ch->ch_lat_rx)
+			dgrp_lat_end(ch, LAT_RX_PUSH, &ch->ch_lat_rx,
+				     ch->ch_rin != ch->ch_rout);
+	}
+#else
 	if (len && !(ch->ch_flag & CH_RXSTOP)) {
-		dbg_net_trace(INPUT, ("OK, not CH_RXSTOP parmrk(%x)\n",
-				ch->ch_iflag & IF_PARMRK));
 
 		dgrp_read_data_block(ch, myflipbuf, len, len);
 
@@ -651,10 +716,8 @@ static void dgrp_input(struct ch_struct *ch)
 		}
 
 
-		dbg_net_trace(INPUT, ("len(%d)\n", len));
-
-		if (nd->nd_dpa_debug && nd->nd_dpa_port == PORT_NUM(MINOR(tty_devnum(tty))))
-			dgrp_dpa_data(nd, 1, myflipbuf, len);
+		if (DGRP_DPA_TRACED(nd, ch->ch_portnum))
+			dgrp_dpa_data(nd, ch->ch_portnum, 1, myflipbuf, len);
 
 		/*
 		 * If we're doing raw reads, jam it right into the
@@ -665,24 +728,20 @@ static void dgrp_input(struct ch_struct *ch)
 					("Have rawreadok and l_real_raw! len:%d\n", len));
 			ld->ops->receive_buf(tty, myflipbuf, NULL, len);
 		} else {
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
 			len = tty_buffer_request_room(tty, len);
 			tty_insert_flip_string_flags(tty, myflipbuf, myflipflagbuf, len);
 
 			/* Tell the tty layer its okay to "eat" the data now */
 			tty_flip_buffer_push(tty);
-#else
-			len = tty_buffer_request_room(&ch->port, len);
-			tty_insert_flip_string_flags(&ch->port, myflipbuf, myflipflagbuf,
-					len);
-
-			/* Tell the tty layer its okay to "eat" the data now */
-			tty_flip_buffer_push(&ch->port);
-#endif
 		}
 
 		ch->ch_rxcount += len;
+
+		if (ch->ch_lat_rx)
+			dgrp_lat_end(ch, LAT_RX_PUSH, &ch->ch_lat_rx,
+				     ch->ch_rin != ch->ch_rout);
 	}
+#endif
 
 	if (ld)
 		tty_ldisc_deref(ld);
@@ -693,10 +752,39 @@ static void dgrp_input(struct ch_struct *ch)
 	 */
 	wake_up_interruptible(&ch->ch_flag_wait);
 
-	dbg_net_trace(INPUT, ("input(%x) complete remain=%d\n",
-	    nd->nd_ID, remain));
+	trace_dgrp_input(ch, data_len, (ch->ch_flag & CH_RXSTOP) ? 0 : len);
+}
+
 
-	dbg_net_trace(INPUT, ("input(%x) complete\n", nd->nd_ID));
+/*
+ * Return the offset of the first 0xFF in buf, or len if there is none.
+ * Aligned words are checked whole: a byte of w is 0xFF exactly when
+ * the same byte of ~w is zero.
+ */
+static int dgrp_find_ff(const unsigned char *buf, int len)
+{
+	const ulong ones = ~0UL / 0xff;
+	const ulong highs = ones << 7;
+	ulong w;
+	int i = 0;
+
+	while (i < len && ((ulong) (buf + i) & (sizeof(ulong) - 1))) {
+		if (buf[i] == 0xff)
+			return i;
+		i++;
+	}
+
+	while (len - i >= (int) sizeof(ulong)) {
+		w = ~*(const ulong *) (buf + i);
+		if ((w - ones) & ~w & highs)
+			break;
+		i += sizeof(ulong);
+	}
+
+	while (i < len && buf[i] != 0xff)
+		i++;
+
+	return i;
 }
 
 
@@ -724,11 +812,126 @@ static void dgrp_input(struct ch_struct *ch)
 *
 ******************************************************************************/
 
+/*
+ * Run one received character through the 0xFF escape state machine.
+ * Returns the TTY_* flag to pass the character up with, or -1 if it
+ * was part of an escape and produces nothing by itself.
+ */
+static int
+parity_scan_char(struct ch_struct *ch, int DOS, unsigned char c)
+{
+	int flag;
+
+	switch (ch->ch_pscan_state) {
+	default:
+		/* reset to sanity and fall through */
+		ch->ch_pscan_state = 0 ;
+
+	case 0:
+		/* No FF seen yet */
+		if (c == (unsigned char) '\377') {
+			/* delete this character from stream */
+			ch->ch_pscan_state = 1;
+			return -1;
+		}
+		return TTY_NORMAL;
+
+	case 1:
+		/* first FF seen */
+		if (c == (unsigned char) '\377') {
+			/* doubled ff, transform to single ff */
+			ch->ch_pscan_state = 0;
+			return TTY_NORMAL;
+		}
+
+		/* save value examination in next state */
+		ch->ch_pscan_savechar = c;
+		ch->ch_pscan_state = 2;
+		return -1;
+
+	case 2:
+		/* third character of ff sequence */
+		if (DOS) {
+			if (ch->ch_pscan_savechar & 0x10) {
+				flag = TTY_BREAK;
+			} else if (ch->ch_pscan_savechar & 0x08) {
+				flag = TTY_FRAME;
+			} else {
+				/*
+				 * either marked as a parity error,
+				 * indeterminate, or not in DOSMODE
+				 * call it a parity error
+				 */
+				flag = TTY_PARITY;
+			}
+		} else {  /* not DOSMODE */
+
+			/* case FF XX ?? where XX is not 00 */
+			if (ch->ch_pscan_savechar & 0xff) {
+				/* this should not happen */
+				flag = TTY_PARITY;
+			}
+			/* case FF 00 XX where XX is not 00 */
+			else if (c & 0xff) {
+				flag = TTY_PARITY;
+			}
+			/* case FF 00 00 */
+			else {
+				flag = TTY_BREAK;
+			}
+		}
+		ch->ch_pscan_state = 0;
+
+		if (flag == TTY_FRAME)
+			ch->ch_icount.frame++;
+		else if (flag == TTY_PARITY)
+			ch->ch_icount.parity++;
+
+		trace_dgrp_rx_error(ch, flag);
+
+		return flag;
+	}
+}
+
+
+/*
+ * Count the modem signal changes between mlast and mstat, and wake
+ * any TIOCMIWAIT sleepers if one of the signals they can wait on
+ * has changed.  The change is also passed on to monitor readers and
+ * netlink event listeners.
+ */
+static void dgrp_modem_change(struct ch_struct *ch, uchar mlast, uchar mstat)
+{
+	uchar delta = mlast ^ mstat;
+
+	if (delta & DM_CTS)
+		ch->ch_icount.cts++;
+	if (delta & DM_DSR)
+		ch->ch_icount.dsr++;
+	if (delta & DM_RI)
+		ch->ch_icount.rng++;
+	if (delta & DM_CD)
+		ch->ch_icount.dcd++;
+
+	if (delta & (DM_CTS | DM_DSR | DM_RI | DM_CD)) {
+		wake_up_interruptible(&ch->ch_mwait);
+
+		dgrp_genl_modem(ch, mstat);
+
+		if (ch->ch_nd->nd_mon_count != 0)
+			dgrp_monitor_modem(ch->ch_nd, ch, mlast, mstat);
+	}
+}
+
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
 static void
 parity_scan(struct ch_struct *ch, unsigned char *cbuf, unsigned char *fbuf, int *len)
 {
 	int l = *len;
 	int count = 0;
+	int n;
+	int flag;
 	int DOS = ((ch->ch_iflag & IF_DOSMODE) == 0 ? 0 : 1);
 
 	/*
@@ -744,86 +947,112 @@ parity_scan(struct ch_struct *ch, unsigned char *cbuf, unsigned char *fbuf, int
 
 	dbg_net_trace(INPUT, ("in parity_scan, l(%d)\n", l));
 
-	while (l--) {
-		c = *in++ ;
-		switch (ch->ch_pscan_state) {
-		default:
-			/* reset to sanity and fall through */
-			ch->ch_pscan_state = 0 ;
-
-		case 0:
-			/* No FF seen yet */
-			if (c == (unsigned char) '\377') {
-				/* delete this character from stream */
-				dbg_net_trace(INPUT, ("parity_scan: read first 0xFF\n"));
-				ch->ch_pscan_state = 1;
-			} else {
-				*cout++ = c;
-				*fout++ = TTY_NORMAL;
-				count += 1;
+	while (l > 0) {
+		/*
+		 * Outside an escape, move the whole run up to the
+		 * next 0xFF in one go.
+		 */
+		if (ch->ch_pscan_state == 0) {
+			n = dgrp_find_ff(in, l);
+			if (n) {
+				if (cout != in)
+					memmove(cout, in, n);
+				memset(fout, TTY_NORMAL, n);
+				in += n;
+				cout += n;
+				fout += n;
+				count += n;
+				l -= n;
+				continue;
 			}
-			break;
+		}
 
-		case 1:
-			/* first FF seen */
-			if (c == (unsigned char) '\377') {
-				/* doubled ff, transform to single ff */
-				dbg_net_trace(INPUT, ("parity_scan: read second 0xFF\n"));
-				*cout++ = c;
-				*fout++ = TTY_NORMAL;
-				count += 1;
-				ch->ch_pscan_state = 0;
-			} else {
-				/* save value examination in next state */
-				dbg_net_trace(INPUT, ("parity_scan: read second char\n"));
-				ch->ch_pscan_savechar = c;
-				ch->ch_pscan_state = 2;
-			}
-			break;
-		case 2:
-			/* third character of ff sequence */
+		c = *in++ ;
+		l--;
+		flag = parity_scan_char(ch, DOS, c);
+		if (flag >= 0) {
 			*cout++ = c;
-			if (DOS) {
-				if (ch->ch_pscan_savechar & 0x10) {
-					dbg_net_trace(INPUT, ("parity_scan: received TTY_BREAK\n"));
-					*fout++ = TTY_BREAK;
-				} else if (ch->ch_pscan_savechar & 0x08) {
-					dbg_net_trace(INPUT, ("parity_scan: received TTY_FRAME\n"));
-					*fout++ = TTY_FRAME;
-				} else {
-					/*
-					 * either marked as a parity error,
-					 * indeterminate, or not in DOSMODE
-					 * call it a parity error
-					 */
-					dbg_net_trace(INPUT, ("parity_scan: received TTY_PARITY\n"));
-					*fout++ = TTY_PARITY;
-				}
-			} else {  /* not DOSMODE */
-
-				/* case FF XX ?? where XX is not 00 */
-				if (ch->ch_pscan_savechar & 0xff) {
-					/* this should not happen */
-					dbg_net_trace(INPUT, ("parity_scan: error!!!\n"));
-					*fout++ = TTY_PARITY;
-				}
-				/* case FF 00 XX where XX is not 00 */
-				else if (c & 0xff) {
-					dbg_net_trace(INPUT, ("parity_scan: TTY_PARITY\n"));
-					*fout++ = TTY_PARITY;
-				}
-				/* case FF 00 00 */
-				else {
-					dbg_net_trace(INPUT, ("parity_scan: received TTY_BREAK\n"));
-					*fout++ = TTY_BREAK;
-				}
-			}
+			*fout++ = flag;
 			count += 1;
-			ch->ch_pscan_state = 0;
 		}
 	}
 	*len = count;
 }
+#else
+/*
+ * parity_scan() straight from rbuf into the port's flip buffers.
+ * Clean runs go in with a fixed TTY_NORMAL flag, and only the
+ * characters produced by 0xFF escapes are inserted one at a time.
+ * Consumes up to len bytes of rbuf; the caller has already reserved
+ * that much flip buffer room.  Returns the number of characters
+ * passed up.
+ */
+static int dgrp_input_scan(struct ch_struct *ch, struct tty_struct *tty,
+			   int len)
+{
+	struct nd_struct *nd = ch->ch_nd;
+	int DOS = ((ch->ch_iflag & IF_DOSMODE) == 0 ? 0 : 1);
+	int dpa = DGRP_DPA_TRACED(nd, ch->ch_portnum);
+	unsigned char *in;
+	unsigned char c;
+	int count = 0;
+	int flag;
+	int n;
+
+	while (len > 0) {
+		in = ch->ch_rbuf + ch->ch_rout;
+		n = 0;
+
+		/*
+		 * Only a clean run outside an escape goes in as a
+		 * block; inside an escape every byte must go through
+		 * parity_scan_char().
+		 */
+		if (ch->ch_pscan_state == 0)
+			n = dgrp_find_ff(in, min(len, RBUF_MAX - ch->ch_rout));
+
+		if (n) {
+			n = tty_insert_flip_string_fixed_flag(&ch->port, in,
+							      TTY_NORMAL, n);
+			if (n <= 0)
+				break;
+			if (dpa)
+				dgrp_dpa_data(nd, ch->ch_portnum, 1, in, n);
+			count += n;
+		} else {
+			n = 1;
+			c = *in;
+			flag = parity_scan_char(ch, DOS, c);
+			if (flag >= 0) {
+				tty_insert_flip_char(&ch->port, c, flag);
+				if (dpa)
+					dgrp_dpa_data(nd, ch->ch_portnum, 1, &c, 1);
+				count += 1;
+			}
+		}
+
+		ch->ch_rout = (ch->ch_rout + n) & RBUF_MASK;
+		len -= n;
+	}
+
+	return count;
+}
+#endif
+
+
+/*
+ *  Move the node to a new NS_* state, telling event listeners when it
+ *  actually changes.
+ */
+static void dgrp_net_state(struct nd_struct *nd, int state)
+{
+	if (nd->nd_state == state)
+		return;
+
+	nd->nd_state = state;
+	trace_dgrp_node_state(nd);
+	dgrp_genl_node_state(nd);
+}
 
 
 /*****************************************************************************
@@ -857,7 +1086,7 @@ static void dgrp_net_idle(struct nd_struct *nd)
 
 	nd->nd_tx_work = 1;
 
-	nd->nd_state = NS_IDLE;
+	dgrp_net_state(nd, NS_IDLE);
 	nd->nd_flag = 0;
 
 	i = nd->nd_seq_out;
@@ -888,6 +1117,9 @@ static void dgrp_net_idle(struct nd_struct *nd)
 
 		ch->ch_otype = 0;
 		ch->ch_otype_waiting = 0;
+
+		/* a new connection must be queried afresh */
+		ch->ch_known = 0;
 	}
 }
 
@@ -1006,7 +1238,7 @@ static void dgrp_chan_count(struct nd_struct *nd, int n)
 				 * so you will notice we don't register them
 				 * here anymore.
 				 */
-				if (GLBL(register_prdevices)) {
+				if (nd->nd_ttdriver_flags & XPRINT_TTDRV_REG) {
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
 					classp = tty_register_device(nd->nd_xprint_ttdriver, i, NULL);
 #else
@@ -1040,6 +1272,7 @@ static void dgrp_chan_count(struct nd_struct *nd, int n)
 			 *  Make any open ports inoperative.
 			 */
 			ch->ch_state = CS_IDLE;
+			ch->ch_known = 0;
 
 			ch->ch_otype = 0;
 			ch->ch_otype_waiting = 0;
@@ -1067,6 +1300,7 @@ static void dgrp_chan_count(struct nd_struct *nd, int n)
 				ch->ch_flag |= CH_PORT_GONE;
 
 			wake_up_interruptible(&ch->ch_flag_wait);
+			wake_up_interruptible(&ch->ch_mwait);
 
 			nd->nd_chan_count = i;
 
@@ -1114,7 +1348,7 @@ static void dgrp_chan_count(struct nd_struct *nd, int n)
 				 * here anymore.
 				 */
 
-				if (GLBL(register_prdevices)) {
+				if (nd->nd_ttdriver_flags & XPRINT_TTDRV_REG) {
 					dgrp_remove_tty_sysfs(ch->ch_pun.un_sysfs);
 					snprintf(name, DEVICE_NAME_SIZE, "pr_%d", i);
 					sysfs_remove_link(&nd->nd_class_dev->kobj, name);
@@ -1131,7 +1365,7 @@ static void dgrp_chan_count(struct nd_struct *nd, int n)
 *
 * Function:
 *
-*    dgrp_monitor
+*    dgrp_encode_time
 *
 * Author:
 *
@@ -1139,9 +1373,8 @@ static void dgrp_chan_count(struct nd_struct *nd, int n)
 *
 * Parameters:
 *
-*    nd   -- pointer to a node structure
-*    buf  -- buffer of data to copy to the monitoring buffer
-*    nbuf -- number of bytes to transfer to the buffer
+*    mon -- pointer to a monitor reader
+*    buf -- destination for time
 *
 * Return Values:
 *
@@ -1149,99 +1382,121 @@ static void dgrp_chan_count(struct nd_struct *nd, int n)
 *
 * Description:
 *
-*    Called by the net device routines to send data to the device
-*    monitor queue.  If the device monitor buffer is too full to
-*    accept the data, it waits until the buffer is ready.
+*    Encodes "rpdump" time into a 4-byte quantity.  Time is measured since
+*    the reader opened the monitor.
 *
 ******************************************************************************/
 
-static void dgrp_monitor(struct nd_struct *nd, uchar *buf, int nbuf)
+static void dgrp_encode_time(struct mon_struct *mon, uchar *buf)
 {
-	int n;
-	int r;
-	int rtn;
-
-	/*
-	 *  Grab monitor lock.
-	 */
-	down(&nd->nd_mon_semaphore);
+	ulong t;
 
 	/*
-	 *  Loop while data remains.
+	 *  Convert time in HZ since open to time in milliseconds
+	 *  since open.
 	 */
-	while (nbuf > 0 && nd->nd_mon_buf != 0) {
-		/*
-		 *  Determine the amount of available space left in the
-		 *  buffer.  If there's none, wait until some appears.
-		 */
-
-		n = (nd->nd_mon_out - nd->nd_mon_in - 1) & MON_MASK;
+	t = jiffies - mon->mon_lbolt;
+	t = 1000 * (t / HZ) + 1000 * (t % HZ) / HZ;
 
-		if (n == 0) {
+	dgrp_encode_u4(buf, (uint)(t & 0xffffffff));
+}
 
-			nd->nd_mon_flag |= MON_WAIT_SPACE;
 
-			up(&nd->nd_mon_semaphore);
+/*
+ * Copy n bytes into the reader's ring at offset in, wrapping as needed.
+ * Returns the offset following the data.
+ */
+static int dgrp_monitor_copy(struct mon_struct *mon, int in, uchar *buf, int n)
+{
+	int r = mon->mon_size - in;
 
-			/*
-			 * Go to sleep waiting until the condition becomes true.
-			 */
-			rtn = wait_event_interruptible(nd->nd_mon_wqueue,
-				((nd->nd_mon_flag & MON_WAIT_SPACE) == 0));
+	if (r <= n) {
+		memcpy(mon->mon_buf + in, buf, r);
+		buf += r;
+		n -= r;
+		in = 0;
+	}
 
-			/*
-			 *  We can't exit here if we receive a signal, since
-			 *  to do so would trash the debug stream.
-			 */
+	memcpy(mon->mon_buf + in, buf, n);
 
-			down(&nd->nd_mon_semaphore);
+	return in + n;
+}
 
-			continue;
-		}
 
-		/*
-		 * Copy as much data as will fit.
-		 */
+/*
+ * Add one record to a reader's ring, or drop it whole if it does not
+ * fit.  Once space returns, a message record notes how many records
+ * were lost before the next one goes in.
+ *
+ * The net routines are the only producer and dgrp_mon_read(), or a
+ * tool that has the ring mmap()ed, the only consumer, so the ring needs
+ * no lock: each side publishes its own index in the shared ring_ctl
+ * after a barrier.  A mapped ring_ctl can be written by user space, so
+ * its indices are only ever used masked.
+ */
+static void dgrp_monitor_put(struct nd_struct *nd, struct mon_struct *mon,
+			     uchar *header, int nhdr, uchar *buf, int nbuf)
+{
+	int mask = mon->mon_size - 1;
+	uchar mhdr[7];
+	char msg[40];
+	int space;
+	int in;
+	int n;
 
-		if (n > nbuf)
-			n = nbuf;
+	in = mon->mon_ctl->rg_head & mask;
+	space = (mon->mon_ctl->rg_tail - in - 1) & mask;
 
-		r = MON_MAX - nd->nd_mon_in;
+	/*
+	 *  Don't overwrite anything until the reader's pointer has
+	 *  been seen.
+	 */
+	smp_mb();
 
-		if (r <= n) {
-			memcpy(nd->nd_mon_buf + nd->nd_mon_in, buf, r);
+	if (mon->mon_lost != 0) {
+		n = sprintf(msg, "Monitor dropped %lu records",
+			    mon->mon_lost);
 
-			n -= r;
+		if (n + (int) sizeof(mhdr) + nhdr + nbuf > space)
+			goto drop;
 
-			nd->nd_mon_in = 0;
+		mhdr[0] = RPDUMP_MESSAGE;
+		dgrp_encode_time(mon, mhdr + 1);
+		dgrp_encode_u2(mhdr + 5, n);
 
-			buf += r;
-			nbuf -= r;
-		}
+		in = dgrp_monitor_copy(mon, in, mhdr, sizeof(mhdr));
+		in = dgrp_monitor_copy(mon, in, (uchar *) msg, n);
 
-		memcpy(nd->nd_mon_buf + nd->nd_mon_in, buf, n);
+		mon->mon_lost = 0;
+	} else if (nhdr + nbuf > space) {
+		goto drop;
+	}
 
-		nd->nd_mon_in += n;
+	in = dgrp_monitor_copy(mon, in, header, nhdr);
+	if (nbuf)
+		in = dgrp_monitor_copy(mon, in, buf, nbuf);
 
-		buf += n;
-		nbuf -= n;
+	/*
+	 *  Publish the record, then wake the reader if it is waiting.
+	 */
+	smp_wmb();
+	mon->mon_ctl->rg_head = in & mask;
 
-		assert(nd->nd_mon_in < MON_MAX);
+	smp_mb();
+	if (waitqueue_active(&mon->mon_wqueue))
+		wake_up_interruptible(&mon->mon_wqueue);
+	return;
 
-		/*
-		 *  Wakeup any thread waiting for data
-		 */
+drop:
+	mon->mon_lost++;
+	mon->mon_drops++;
+	mon->mon_drop_bytes += nhdr + nbuf;
 
-		if (nd->nd_mon_flag & MON_WAIT_DATA) {
-			nd->nd_mon_flag &= ~MON_WAIT_DATA;
-			wake_up_interruptible(&nd->nd_mon_wqueue);
-		}
-	}
+	mon->mon_ctl->rg_drops = mon->mon_drops;
+	mon->mon_ctl->rg_drop_bytes = mon->mon_drop_bytes;
 
-	/*
-	 *  Release the monitor lock.
-	 */
-	up(&nd->nd_mon_semaphore);
+	nd->nd_mon_drops++;
+	nd->nd_mon_drop_bytes += nhdr + nbuf;
 }
 
 
@@ -1249,7 +1504,7 @@ static void dgrp_monitor(struct nd_struct *nd, uchar *buf, int nbuf)
 *
 * Function:
 *
-*    dgrp_encode_time
+*    dgrp_monitor
 *
 * Author:
 *
@@ -1257,8 +1512,13 @@ static void dgrp_monitor(struct nd_struct *nd, uchar *buf, int nbuf)
 *
 * Parameters:
 *
-*    nd  -- pointer to a node structure
-*    buf -- destination for time
+*    nd    -- pointer to a node structure
+*    class -- MF_* class of the record
+*    type  -- rpdump record type
+*    buf   -- record data, or NULL
+*    size  -- number of bytes of record data
+*    ports -- ports the record concerns, or NULL if it is not port
+*             specific
 *
 * Return Values:
 *
@@ -1266,23 +1526,42 @@ static void dgrp_monitor(struct nd_struct *nd, uchar *buf, int nbuf)
 *
 * Description:
 *
-*    Encodes "rpdump" time into a 4-byte quantity.  Time is measured since
-*    open.
+*    Called by the net device routines, with nd_net_semaphore held, to
+*    add an rpdump record to the queue of every monitor reader whose
+*    filter accepts it.  The monitor must never hold up the data path,
+*    so a reader without room for the record loses it; see
+*    dgrp_monitor_put().
 *
 ******************************************************************************/
 
-static void dgrp_encode_time(struct nd_struct *nd, uchar *buf)
+static void dgrp_monitor(struct nd_struct *nd, uint class, int type,
+			 uchar *buf, int size, unsigned long *ports)
 {
-	ulong t;
+	struct mon_struct *mon;
+	uchar header[7];
+	int nhdr;
 
-	/*
-	 *  Convert time in HZ since open to time in milliseconds
-	 *  since open.
-	 */
-	t = jiffies - nd->nd_mon_lbolt;
-	t = 1000 * (t / HZ) + 1000 * (t % HZ) / HZ;
+	list_for_each_entry(mon, &nd->nd_mon_list, mon_list) {
+		if ((mon->mon_flags & class) == 0)
+			continue;
 
-	dgrp_encode_u4(buf, (uint)(t & 0xffffffff));
+		if (ports && mon->mon_portsel &&
+		    !bitmap_intersects(mon->mon_ports, ports, CHAN_MAX))
+			continue;
+
+		header[0] = type;
+
+		dgrp_encode_time(mon, header + 1);
+
+		if (type == RPDUMP_RESET) {
+			nhdr = 5;
+		} else {
+			dgrp_encode_u2(header + 5, size);
+			nhdr = 7;
+		}
+
+		dgrp_monitor_put(nd, mon, header, nhdr, buf, size);
+	}
 }
 
 
@@ -1314,18 +1593,8 @@ static void dgrp_encode_time(struct nd_struct *nd, uchar *buf)
 
 static void dgrp_monitor_message(struct nd_struct *nd, char *message)
 {
-	uchar header[7];
-	int n;
-
-	header[0] = RPDUMP_MESSAGE;
-
-	dgrp_encode_time(nd, header + 1);
-
-	n = strlen(message);
-	dgrp_encode_u2(header + 5, n);
-
-	dgrp_monitor(nd, header, sizeof(header));
-	dgrp_monitor(nd, (uchar *) message, n);
+	dgrp_monitor(nd, MF_MESSAGE, RPDUMP_MESSAGE,
+		     (uchar *) message, strlen(message), NULL);
 }
 
 
@@ -1356,13 +1625,7 @@ static void dgrp_monitor_message(struct nd_struct *nd, char *message)
 
 static void dgrp_monitor_reset(struct nd_struct *nd)
 {
-	uchar header[5];
-
-	header[0] = RPDUMP_RESET;
-
-	dgrp_encode_time(nd, header + 1);
-
-	dgrp_monitor(nd, header, sizeof(header));
+	dgrp_monitor(nd, MF_MESSAGE, RPDUMP_RESET, NULL, 0, NULL);
 }
 
 
@@ -1379,10 +1642,12 @@ static void dgrp_monitor_reset(struct nd_struct *nd)
 *
 * Parameters:
 *
-*    nd   -- pointer to a node structure
-*    type -- type of message to be logged in the message buffer
-*    buf  -- buffer of data to be logged in the message buffer
-*    size -- number of bytes in the "buf" buffer
+*    nd    -- pointer to a node structure
+*    type  -- type of message to be logged in the message buffer
+*    buf   -- buffer of data to be logged in the message buffer
+*    size  -- number of bytes in the "buf" buffer
+*    ports -- ports with commands or data in the buffer, or NULL if
+*             unknown
 *
 * Return Values:
 *
@@ -1394,18 +1659,33 @@ static void dgrp_monitor_reset(struct nd_struct *nd)
 *
 ******************************************************************************/
 
-static void dgrp_monitor_data(struct nd_struct *nd, int type, uchar *buf, int size)
+static void dgrp_monitor_data(struct nd_struct *nd, int type, uchar *buf,
+			      int size, unsigned long *ports)
 {
-	uchar header[7];
+	dgrp_monitor(nd, type == RPDUMP_CLIENT ? MF_CLIENT : MF_SERVER,
+		     type, buf, size, ports);
+}
+
 
-	header[0] = type;
 
-	dgrp_encode_time(nd, header + 1);
+/*
+ * Note a modem signal change on a port for readers that asked for
+ * MF_MODEM records.
+ */
+static void dgrp_monitor_modem(struct nd_struct *nd, struct ch_struct *ch,
+			       uchar mlast, uchar mstat)
+{
+	DECLARE_BITMAP(ports, CHAN_MAX);
+	char msg[40];
+	int n;
+
+	bitmap_zero(ports, CHAN_MAX);
+	set_bit(ch->ch_portnum, ports);
 
-	dgrp_encode_u2(header + 5, size);
+	n = sprintf(msg, "Port %d modem %02x -> %02x",
+		    ch->ch_portnum, mlast, mstat);
 
-	dgrp_monitor(nd, header, sizeof(header));
-	dgrp_monitor(nd, buf, size);
+	dgrp_monitor(nd, MF_MODEM, RPDUMP_MESSAGE, (uchar *) msg, n, ports);
 }
 
 
@@ -1536,9 +1816,11 @@ static int dgrp_net_open(struct inode *inode, struct file *file)
 		goto unlock;
 	}
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
 	/*
 	 * Allocate a buffer for doing the copy from kernel space to
-	 * tty buffer space in the read routines.
+	 * tty buffer space in the read routines.  Later kernels
+	 * insert straight from each channel's rbuf instead.
 	 */
 	nd->nd_inputbuf = kmalloc(MYFLIPLEN, GFP_KERNEL);
 	if (!nd->nd_inputbuf) {
@@ -1555,6 +1837,7 @@ static int dgrp_net_open(struct inode *inode, struct file *file)
 		rtn = -ENOMEM;
 		goto unlock;
 	}
+#endif
 
 	/*
 	 *  The port is now open, so move it to the IDLE state
@@ -1657,7 +1940,7 @@ static int dgrp_net_release(struct inode *inode, struct file *file)
 	 */
 	dgrp_net_idle(nd);
 
-	nd->nd_state = NS_CLOSED;
+	dgrp_net_state(nd, NS_CLOSED);
 	nd->nd_flag = 0;
 
 	/*
@@ -1761,6 +2044,204 @@ done:
 }
 
 
+/*
+ *      dgrp_rwin_tune:
+ *
+ *      Adapt the receive window of a channel to the rate at which the
+ *      tty layer drains it, in the style of TCP receive autotuning.
+ *
+ *      The window starts at the size of the channel receive buffer and
+ *      is only cut back under back-pressure.  Once per RWIN_TUNE_TIME
+ *      the data still queued in the receive buffer and the bytes handed
+ *      to the line discipline are compared with the current window.  A
+ *      reader that left half a window queued and drained less than half
+ *      a window since the last look is falling behind, so the window is
+ *      shrunk by a quarter and a port nobody reads stops pulling data
+ *      it cannot use.  Once the backlog is under a quarter window the
+ *      window doubles again.  The window stays between RWIN_MIN and the
+ *      size of the channel receive buffer.
+ *
+ *      While the window is at least half the buffer the server RLOW/RHIGH
+ *      water marks are raised so the server holds off input flow control
+ *      longer.
+ *
+ *      With autotuning off the full buffer is offered and the water marks
+ *      are not touched, so a port opened then keeps the 2/8 and 6/8 set
+ *      when it opened.
+ *
+ *      Returns non-zero if RLOW/RHIGH changed and must be sent.
+ */
+static int dgrp_rwin_tune(struct ch_struct *ch)
+{
+	long backlog;
+	long drained;
+	long win;
+	ushort rlow;
+	ushort rhigh;
+
+	if (!GLBL(rwin_autotune)) {
+		ch->ch_rwin_max = RBUF_MAX - 1;
+		return 0;
+	}
+
+	if ((ulong)(jiffies - ch->ch_rwin_time) < RWIN_TUNE_TIME)
+		return 0;
+
+	backlog = (ch->ch_rin - ch->ch_rout) & RBUF_MASK;
+	drained = ch->ch_rxcount - ch->ch_rwin_rxcount;
+
+	ch->ch_rwin_rxcount = ch->ch_rxcount;
+	ch->ch_rwin_time = jiffies;
+
+	win = ch->ch_rwin_max;
+
+	if (2 * backlog >= win && 2 * drained < win)
+		win -= win / 4;
+	else if (4 * backlog < win)
+		win *= 2;
+
+	if (win < RWIN_MIN)
+		win = RWIN_MIN;
+
+	if (win > RBUF_MAX - 1)
+		win = RBUF_MAX - 1;
+
+	ch->ch_rwin_max = win;
+
+	if (win >= RBUF_MAX / 2) {
+		rlow  = 4 * ch->ch_s_rsize / 8;
+		rhigh = 7 * ch->ch_s_rsize / 8;
+	} else {
+		rlow  = 2 * ch->ch_s_rsize / 8;
+		rhigh = 6 * ch->ch_s_rsize / 8;
+	}
+
+	if (ch->ch_rlow == rlow && ch->ch_rhigh == rhigh)
+		return 0;
+
+	ch->ch_rlow  = rlow;
+	ch->ch_rhigh = rhigh;
+	ch->ch_flag |= CH_PARAM;
+
+	return 1;
+}
+
+
+/*
+ *      dgrp_rx_batch:
+ *
+ *      Adaptive receive batching.  Called for each data packet of
+ *      "dlen" bytes received on a channel in BATCH_ADAPTIVE mode.
+ *
+ *      A running average of the packet size tells interactive from
+ *      bulk traffic.  Small packets mean someone is typing, so RTIME
+ *      drops to 10 milliseconds and the server forwards each key
+ *      quickly.  Packets that fill most of RMAX mean the port is
+ *      streaming, so RMAX doubles, up to half of the server buffer,
+ *      and the server sends fewer, larger packets.  If the packets
+ *      still fill RMAX once it has reached that limit, RTIME doubles
+ *      as well, up to four times the default, so the server waits
+ *      longer to fill each packet.  Both fall back toward their
+ *      defaults once the packets shrink again.
+ */
+static void dgrp_rx_batch(struct ch_struct *ch, long dlen)
+{
+	long avg;
+	ushort rmax;
+	ushort rtime;
+
+	ch->ch_rx_avg += dlen - ch->ch_rx_avg / 8;
+
+	avg = ch->ch_rx_avg / 8;
+
+	rmax  = ch->ch_rmax;
+	rtime = ch->ch_rtime;
+
+	if (rtime < GLBL(rtime))
+		rtime = GLBL(rtime);
+
+	if (avg <= 3) {
+		rtime = 10;
+		rmax  = ch->ch_s_rsize / 4;
+
+	} else if (4 * avg >= 3 * rmax) {
+		if (rmax < ch->ch_s_rsize / 2) {
+			rmax *= 2;
+
+			if (rmax > ch->ch_s_rsize / 2)
+				rmax = ch->ch_s_rsize / 2;
+		} else {
+			if (2 * rtime > 4 * GLBL(rtime))
+				rtime = 4 * GLBL(rtime);
+			else
+				rtime *= 2;
+		}
+
+	} else if (4 * avg < rmax) {
+		rtime = GLBL(rtime);
+		rmax /= 2;
+
+		if (rmax < ch->ch_s_rsize / 4)
+			rmax = ch->ch_s_rsize / 4;
+	}
+
+	if (ch->ch_rmax != rmax || ch->ch_rtime != rtime) {
+		ch->ch_rmax  = rmax;
+		ch->ch_rtime = rtime;
+		ch->ch_flag |= CH_PARAM;
+	}
+}
+
+
+/*
+ *      dgrp_tx_hold:
+ *
+ *      Decide whether queued transmit data should be held back so
+ *      that writes on several ports can share one packet.  "ttotal"
+ *      is the number of bytes (including headers) ready to go out.
+ *
+ *      Data is held while the node has a hold time configured, the
+ *      queued total is below the node byte target, and the oldest
+ *      held data has waited less than the hold time.  The poller
+ *      wakes the daemon every poll tick while work is pending, so
+ *      the hold time is honored to within one tick.
+ *
+ *      Returns non-zero if the data should be held.
+ */
+static int dgrp_tx_hold(struct nd_struct *nd, long ttotal)
+{
+	struct ch_struct *ch;
+	int i;
+
+	if (nd->nd_hold_time <= 0 || ttotal == 0 ||
+	    ttotal >= nd->nd_hold_bytes)
+		goto release;
+
+	/*
+	 *  Never delay output that a thread is waiting to drain.
+	 */
+	for (i = 0, ch = nd->nd_chan; i < nd->nd_chan_count; i++, ch++) {
+		if ((ch->ch_flag & (CH_EMPTY | CH_DRAIN)) != 0 ||
+		    (ch->ch_pun.un_flag & UN_EMPTY) != 0)
+			goto release;
+	}
+
+	if (!nd->nd_hold_flag) {
+		nd->nd_hold_flag = 1;
+		nd->nd_hold_start = jiffies;
+		return 1;
+	}
+
+	if ((ulong)(jiffies - nd->nd_hold_start) <
+	    dgrp_jiffies_from_ms(nd->nd_hold_time))
+		return 1;
+
+release:
+	nd->nd_hold_flag = 0;
+	return 0;
+}
+
+
 /*****************************************************************************
 *
 * Function:
@@ -1803,6 +2284,7 @@ static int dgrp_send(struct nd_struct *nd, long tmax)
 	uchar *b;
 	uchar *buf;
 	uchar *mbuf;
+	uchar *pb;
 	long mod;
 	long port;
 	long send;
@@ -1821,6 +2303,9 @@ static int dgrp_send(struct nd_struct *nd, long tmax)
 	long wanted_sync_port;
 	ushort tdata[CHAN_MAX];
 	long used_buffer;
+	ulong lock_flags;
+	long tout;
+	struct txvec_struct *tv;
 
 	mod = 0;
 	port = 0;
@@ -1832,6 +2317,11 @@ static int dgrp_send(struct nd_struct *nd, long tmax)
 
 	buf = mbuf = b = nd->nd_iobuf + UIO_BASE;
 
+	nd->nd_txvec_count = 0;
+	nd->nd_txvec_len = 0;
+
+	bitmap_zero(nd->nd_mon_ports, CHAN_MAX);
+
 	send_sync = nd->nd_link.lk_slow_rate < UIO_MAX;
 
 	ttotal = 0;
@@ -1881,6 +2371,8 @@ static int dgrp_send(struct nd_struct *nd, long tmax)
 			maxport = nd->nd_chan_count;
 
 		for (; port < maxport; port++, ch++) {
+			pb = b;
+
 			/*
 			 *  Switch based on channel state.
 			 */
@@ -2003,13 +2495,22 @@ static int dgrp_send(struct nd_struct *nd, long tmax)
 
 					ch->ch_s_tin   = 0;
 					ch->ch_s_tpos  = 0;
-					ch->ch_s_tsize = 0;
 					ch->ch_s_treq  = 0;
 					ch->ch_s_elast = 0;
 
 					ch->ch_s_rin   = 0;
 					ch->ch_s_rwin  = 0;
-					ch->ch_s_rsize = 0;
+
+					/*
+					 *  The buffer sizes and capabilities of a
+					 *  port don't change while the connection
+					 *  is up, so keep what an earlier open of
+					 *  it learned.
+					 */
+					if ((ch->ch_known & RR_BUFFER) == 0) {
+						ch->ch_s_tsize = 0;
+						ch->ch_s_rsize = 0;
+					}
 
 					ch->ch_s_tmax  = 0;
 					ch->ch_s_ttime = 0;
@@ -2064,22 +2565,26 @@ static int dgrp_send(struct nd_struct *nd, long tmax)
 					 *  Send Buffer Request.
 					 */
 
-					b[0] = 0xb0 + (port & 0xf);
-					b[1] = 20;
-					b += 2;
+					if ((ch->ch_known & RR_BUFFER) == 0) {
+						b[0] = 0xb0 + (port & 0xf);
+						b[1] = 20;
+						b += 2;
+					}
 
 					/*
 					 *  Send Port Capability Request.
 					 */
 
-					b[0] = 0xb0 + (port & 0xf);
-					b[1] = 22;
-					b += 2;
+					if ((ch->ch_known & RR_CAPABILITY) == 0) {
+						b[0] = 0xb0 + (port & 0xf);
+						b[1] = 22;
+						b += 2;
+					}
 
 					ch->ch_expect = (RR_SEQUENCE |
 							RR_STATUS  |
 							RR_BUFFER |
-							RR_CAPABILITY);
+							RR_CAPABILITY) & ~ch->ch_known;
 
 					ch->ch_state = CS_WAIT_QUERY;
 
@@ -2117,7 +2622,6 @@ static int dgrp_send(struct nd_struct *nd, long tmax)
 				 *  then close the port.
 				 */
 
-				dbg_net_trace(READ, ("case CS_READY, ch_flag(%x)\n", ch->ch_flag));
 				if (ch->ch_open_count == 0 &&
 				    ch->ch_wait_count[ch->ch_otype] == 0) {
 					goto send_close;
@@ -2147,6 +2651,23 @@ static int dgrp_send(struct nd_struct *nd, long tmax)
 					}
 				}
 
+				/*
+				 *  Pick up the TMAX/TTIME adaptive transmit
+				 *  batching asked for on the write side.
+				 */
+
+				if (ch->ch_tx_batch == BATCH_ADAPTIVE &&
+				    ch->ch_edelay == GLBL(ttime)) {
+					DGRP_LOCK(ch->ch_lock, lock_flags);
+					if (ch->ch_tmax  != ch->ch_tx_tmax ||
+					    ch->ch_ttime != ch->ch_tx_ttime) {
+						ch->ch_tmax  = ch->ch_tx_tmax;
+						ch->ch_ttime = ch->ch_tx_ttime;
+						ch->ch_flag |= CH_PARAM;
+					}
+					DGRP_UNLOCK(ch->ch_lock, lock_flags);
+				}
+
 				/*
 				 *  Handle receive flush, and changes to
 				 *  server port parameters.
@@ -2400,14 +2921,24 @@ static int dgrp_send(struct nd_struct *nd, long tmax)
 
 				/*
 				 *  Send a window sequence to acknowledge received data.
+				 *  The window is the free buffer space, limited by
+				 *  the autotuned window for the channel.  Never
+				 *  retract a window already granted.
 				 */
 
-				rwin = (ch->ch_s_rin +
-					((ch->ch_rout - ch->ch_rin - 1) & RBUF_MASK));
+				if (dgrp_rwin_tune(ch))
+					work = 1;
+
+				n = (ch->ch_rout - ch->ch_rin - 1) & RBUF_MASK;
+
+				if (n > ch->ch_rwin_max)
+					n = ch->ch_rwin_max;
+
+				rwin = ch->ch_s_rin + n;
 
 				n = (rwin - ch->ch_s_rwin) & 0xffff;
 
-				if (n >= RBUF_MAX / 4) {
+				if (n < 0x8000 && n >= ch->ch_rwin_max / 4) {
 					b[0] = 0xa0 + (port & 0xf);
 					dgrp_encode_u2(b + 1, ch->ch_s_rwin = rwin);
 					b += 3;
@@ -2458,7 +2989,7 @@ static int dgrp_send(struct nd_struct *nd, long tmax)
 					if ((ch->ch_pun.un_flag & UN_LOW) != 0 ?
 					    (n <= TBUF_LOW) :
 					    (ch->ch_pun.un_flag & UN_TIME) != 0 ?
-					    TimeGE(jiffies, ch->ch_waketime) :
+					    KtimeGE(ktime_get(), ch->ch_waketime) :
 					    (n == 0 && ch->ch_s_tpos == ch->ch_s_tin) &&
 					    ((ch->ch_pun.un_flag & UN_EMPTY) != 0 ||
 					    ((ch->ch_tun.un_open_count &&
@@ -2532,6 +3063,13 @@ send_close:
 			default:
 				assert(0);
 			}
+
+			/*
+			 *  Note the ports this packet carries, for
+			 *  monitor readers filtering on ports.
+			 */
+			if (b != pb)
+				__set_bit(port, nd->nd_mon_ports);
 		}
 
 		/*
@@ -2598,6 +3136,14 @@ send_close:
 	if (tmax < 2 * nd->nd_chan_count) {
 		tsend = 1;
 
+	/*
+	 *  Hold the data back if the node is coalescing small writes
+	 *  and neither the byte target nor the hold time has been
+	 *  reached.  Commands already built above still go out.
+	 */
+	} else if (dgrp_tx_hold(nd, ttotal)) {
+		tsend = 1;
+
 	} else if (tchan > 1 && ttotal > tmax) {
 
 		/*
@@ -2684,6 +3230,23 @@ send_close:
 
 			lastport = port;
 
+			/*
+			 *  Hold the channel lock from sizing the transmit data
+			 *  until it has been copied and ch_tout moved past it,
+			 *  so a writer or a flush cannot change the buffer
+			 *  under us.
+			 */
+
+			DGRP_LOCK(ch->ch_lock, lock_flags);
+
+			/*
+			 *  Commit anything put_char staged that the line
+			 *  discipline never flushed.
+			 */
+
+			if (ch->ch_pin != ch->ch_pout)
+				dgrp_tty_pflush(ch);
+
 			n = (ch->ch_tin - ch->ch_tout) & TBUF_MASK;
 
 			/*
@@ -2709,8 +3272,10 @@ send_close:
 					n = used_buffer;
 				}
 
-				if (n <= 0)
+				if (n <= 0) {
+					DGRP_UNLOCK(ch->ch_lock, lock_flags);
 					continue;
+				}
 
 				/*
 				 *  Create the correct size transmit header,
@@ -2737,8 +3302,52 @@ send_close:
 
 				ch->ch_s_tin = (ch->ch_s_tin + n) & 0xffff;
 
+				if (ch->ch_lat_tx) {
+					t = (ch->ch_tin - ch->ch_tout) & TBUF_MASK;
+					dgrp_lat_end(ch, LAT_TX_QUEUE,
+						     &ch->ch_lat_tx, t > n);
+				}
+
+				__set_bit(port, nd->nd_mon_ports);
+
+				/*
+				 *  Normally the transmit data stays in ch_tbuf
+				 *  and nd_txvec records where it goes in the
+				 *  packet; dgrp_net_copyout() copies it to the
+				 *  daemon and only then moves ch_tout.  Until
+				 *  then ch_txvec holds off any flush.
+				 */
+
+				if (nd->nd_mon_count == 0) {
+					tout = ch->ch_tout;
+					used_buffer -= n;
+
+					while (n > 0) {
+						t = min_t(long, n, TBUF_MAX - tout);
+
+						tv = &nd->nd_txvec[nd->nd_txvec_count++];
+						tv->tv_ch   = ch;
+						tv->tv_off  = b - buf;
+						tv->tv_pos  = tout;
+						tv->tv_len  = t;
+
+						tout = (tout + t) & TBUF_MASK;
+						tv->tv_tout = tout;
+
+						ch->ch_txvec++;
+						nd->nd_txvec_len += t;
+						n -= t;
+					}
+
+					n = (ch->ch_tin - tout) & TBUF_MASK;
+
+					DGRP_UNLOCK(ch->ch_lock, lock_flags);
+					goto tx_done;
+				}
+
 				/*
-				 *  Copy transmit data to the packet.
+				 *  The monitor wants the whole packet in
+				 *  nd_iobuf, so copy transmit data to it.
 				 */
 
 				t = TBUF_MAX - ch->ch_tout;
@@ -2763,6 +3372,9 @@ send_close:
 				n = (ch->ch_tin - ch->ch_tout) & TBUF_MASK;
 			}
 
+			DGRP_UNLOCK(ch->ch_lock, lock_flags);
+tx_done:
+
 			/*
 			 *  Wake any terminal unit process waiting in the
 			 *  dgrp_write routine for low water.
@@ -2825,6 +3437,8 @@ send_close:
 					b[1] = 43;
 					dgrp_encode_u2(b + 2, ch->ch_s_treq = ch->ch_s_tin);
 					b += 4;
+
+					__set_bit(port, nd->nd_mon_ports);
 				}
 
 				/*
@@ -2898,8 +3512,9 @@ send_close:
 		bb[2] = in;
 		bb += 3;
 
-		nd->nd_seq_size[in] = bb - buf;
+		nd->nd_seq_size[in] = bb - buf + nd->nd_txvec_len;
 		nd->nd_seq_time[in] = jiffies;
+		nd->nd_seq_stamp[in] = GLBL(latency) ? dgrp_lat_now() : 0;
 
 		if (++in >= SEQ_MAX)
 			in = 0;
@@ -2907,7 +3522,7 @@ send_close:
 		if (in != nd->nd_seq_out) {
 			b = bb;
 			nd->nd_seq_in = in;
-			nd->nd_unack += b - buf;
+			nd->nd_unack += b - buf + nd->nd_txvec_len;
 		}
 	}
 
@@ -2935,7 +3550,7 @@ send_close:
 		nd->nd_tx_time = jiffies;
 	}
 
-	n = b - buf;
+	n = b - buf + nd->nd_txvec_len;
 
 	assert(n < tsafe);
 	if (n > tsafe) {
@@ -2950,15 +3565,75 @@ send_close:
 					"tchan=%d, tsend=%d, sent=%d\n",
 					nd->nd_tx_credit, tmax, tchan, tsend, n));
 
-		dgrp_dump(buf, n);
+		dgrp_dump(buf, b - buf);
 	}
 
 	nd->nd_tx_work = work;
 
+	trace_dgrp_send(nd, tmax, n);
+
 	return n;
 }
 
 
+/*
+ * Copy the n byte packet built by dgrp_send() to the daemon's buffer,
+ * taking the header bytes from hbuf and the transmit data straight
+ * from ch_tbuf as described by nd_txvec.  Each piece's tbuf space is
+ * released once it is copied; a flush that came in meanwhile takes
+ * effect after the channel's last piece.
+ */
+static int dgrp_net_copyout(struct nd_struct *nd, char __user *ubuf,
+			    uchar *hbuf, int n)
+{
+	struct txvec_struct *tv;
+	struct ch_struct *ch;
+	ulong lock_flags;
+	int hlen = n - nd->nd_txvec_len;
+	int off = 0;
+	int rtn = 0;
+	int i;
+
+	for (i = 0; i < nd->nd_txvec_count; i++) {
+		tv = &nd->nd_txvec[i];
+		ch = tv->tv_ch;
+
+		if (!rtn && tv->tv_off > off &&
+		    copy_to_user(ubuf, hbuf + off, tv->tv_off - off))
+			rtn = -EFAULT;
+		ubuf += tv->tv_off - off;
+		off = tv->tv_off;
+
+		if (!rtn &&
+		    copy_to_user(ubuf, ch->ch_tbuf + tv->tv_pos, tv->tv_len))
+			rtn = -EFAULT;
+		ubuf += tv->tv_len;
+
+		DGRP_LOCK(ch->ch_lock, lock_flags);
+		ch->ch_tout = tv->tv_tout;
+		if (--ch->ch_txvec == 0 && ch->ch_tflushed) {
+			ch->ch_tout = ch->ch_tflush;
+			ch->ch_tflushed = 0;
+		}
+		DGRP_UNLOCK(ch->ch_lock, lock_flags);
+	}
+
+	if (!rtn && hlen > off && copy_to_user(ubuf, hbuf + off, hlen - off))
+		rtn = -EFAULT;
+
+	/*
+	 * Have the poller look at any writers waiting for the space.
+	 */
+	if (nd->nd_txvec_count)
+		nd->nd_tx_work = 1;
+
+	nd->nd_txvec_count = 0;
+	nd->nd_txvec_len = 0;
+
+	return rtn;
+}
+
+
 /*****************************************************************************
 *
 * Function:
@@ -2990,6 +3665,7 @@ static ssize_t dgrp_net_read(struct file *file, char *buf, size_t count, loff_t
 	uchar *local_buf;
 	uchar *b;
 	ssize_t rtn = 0;
+	int sg;
 
 	dbg_net_trace(READ, ("net read(%p) start\n", file->private_data));
 
@@ -3033,6 +3709,11 @@ static ssize_t dgrp_net_read(struct file *file, char *buf, size_t count, loff_t
 
 	nd->nd_tx_ready = 0;
 
+	nd->nd_txvec_count = 0;
+	nd->nd_txvec_len = 0;
+
+	bitmap_zero(nd->nd_mon_ports, CHAN_MAX);
+
 	/*
 	 *  Determine the effective size of the buffer.
 	 */
@@ -3051,7 +3732,7 @@ static ssize_t dgrp_net_read(struct file *file, char *buf, size_t count, loff_t
 	 */
 
 	case NS_IDLE:
-		if (nd->nd_mon_buf != 0) {
+		if (nd->nd_mon_count != 0) {
 
 			/* TODO : historical locking placeholder */
 			/*
@@ -3108,7 +3789,7 @@ static ssize_t dgrp_net_read(struct file *file, char *buf, size_t count, loff_t
 
 		nd->nd_expect |= NR_VPD;
 
-		nd->nd_state = NS_WAIT_QUERY;
+		dgrp_net_state(nd, NS_WAIT_QUERY);
 		break;
 
 	/*
@@ -3163,9 +3844,14 @@ static ssize_t dgrp_net_read(struct file *file, char *buf, size_t count, loff_t
 	assert(b <= nd->nd_iobuf + UIO_MAX);
 	assert(n <= count);
 
-	rtn = copy_to_user(buf, local_buf, n);
+	/*
+	 *  A packet built around ch_tbuf is not in local_buf as a whole,
+	 *  so it cannot be handed to a monitor opened since dgrp_send().
+	 */
+	sg = nd->nd_txvec_count != 0;
+
+	rtn = dgrp_net_copyout(nd, buf, local_buf, n);
 	if (rtn) {
-		rtn = -EFAULT;
 		up(&nd->nd_net_semaphore);
 		goto done;
 	}
@@ -3174,8 +3860,9 @@ static ssize_t dgrp_net_read(struct file *file, char *buf, size_t count, loff_t
 
 	rtn = n;
 
-	if (nd->nd_mon_buf != 0)
-		dgrp_monitor_data(nd, RPDUMP_CLIENT, local_buf, n);
+	if (nd->nd_mon_count != 0 && !sg)
+		dgrp_monitor_data(nd, RPDUMP_CLIENT, local_buf, n,
+				  nd->nd_mon_ports);
 
 	/*
 	 *  Release the NET lock.
@@ -3258,9 +3945,6 @@ static void dgrp_receive(struct nd_struct *nd)
 		int n0 = b[0] >> 4;
 		int n1 = b[0] & 0x0f;
 
-		dbg_net_trace(INPUT, ("net receive(%d) %d %d\n",
-				        b - buf, n0, n1));
-
 		if (n0 <= 12) {
 			port = (nd->nd_rx_module << 4) + n1;
 
@@ -3269,12 +3953,16 @@ static void dgrp_receive(struct nd_struct *nd)
 				goto prot_error;
 			}
 
+			__set_bit(port, nd->nd_mon_ports);
+
 			ch = nd->nd_chan + port;
 		} else {
 			port = -1;
 			ch = 0;
 		}
 
+		trace_dgrp_receive(nd, port, b[0], remain);
+
 		/*
 		 *  Process by major packet type.
 		 */
@@ -3370,6 +4058,8 @@ data:
 					ch->ch_rtime = ch->ch_edelay;
 					ch->ch_flag |= CH_PARAM;
 				}
+			} else if (ch->ch_rx_batch == BATCH_ADAPTIVE) {
+				dgrp_rx_batch(ch, dlen);
 			} else if (dlen <= 3) {
 				if (ch->ch_rtime != 10) {
 					ch->ch_rtime = 10;
@@ -3408,13 +4098,6 @@ data:
 
 			ch->ch_s_rin = (ch->ch_s_rin + dlen) & 0xffff;
 
-			dbg_net_trace(INPUT, ("in dgrp_receive(%x:%x) state(%x) cflag(%x) flag(%x)\n",
-				MAJOR(tty_devnum(ch->ch_tun.un_tty)), MINOR(tty_devnum(ch->ch_tun.un_tty)),
-				 ch->ch_state, ch->ch_cflag, ch->ch_flag));
-			dbg_net_trace(INPUT, ("in dgrp_receive(%x:%x) open_count(%d) send(%x)\n",
-				MAJOR(tty_devnum(ch->ch_tun.un_tty)), MINOR(tty_devnum(ch->ch_tun.un_tty)),
-				ch->ch_tun.un_open_count, ch->ch_send));
-
 			if (ch->ch_state == CS_READY &&
 			    (ch->ch_tun.un_open_count != 0) &&
 			    (ch->ch_tun.un_flag & UN_CLOSING) == 0 &&
@@ -3422,8 +4105,10 @@ data:
 			    (ch->ch_flag & (CH_BAUD0 | CH_RX_FLUSH)) == 0 &&
 			    (ch->ch_send & RR_RX_FLUSH) == 0) {
 
-				dbg_net_trace(INPUT, ("in dgrp_receive rin(%d) rout(%d)\n ",
-					ch->ch_rin, ch->ch_rout));
+				if (GLBL(latency) &&
+				    (!ch->ch_lat_rx || ch->ch_rin == ch->ch_rout))
+					ch->ch_lat_rx = dgrp_lat_now();
+
 				if (ch->ch_rin + dlen >= RBUF_MAX) {
 					n = RBUF_MAX - ch->ch_rin;
 
@@ -3438,10 +4123,7 @@ data:
 
 				ch->ch_rin += dlen;
 
-				dbg_net_trace(INPUT, ("in dgrp_receive new rin(%d) new rout(%d)\n ",
-					ch->ch_rin, ch->ch_rout));
-				dbg_net_trace(INPUT, ("dgrp_receive MIN_CHAR(%d) TIME_CHAR(%d)\n ",
-					MIN_CHAR(ch->ch_tun.un_tty), TIME_CHAR(ch->ch_tun.un_tty)));
+				trace_dgrp_rx_data(ch, dlen);
 
 				/*
 				 *  If we are not in fastcook mode, or if there is
@@ -3568,6 +4250,8 @@ data:
 						goto prot_error;
 					}
 
+					__set_bit(port, nd->nd_mon_ports);
+
 					ch = nd->nd_chan + port;
 
 					/*
@@ -3726,6 +4410,15 @@ open_error:
 							goto prot_error;
 						}
 					}
+
+					/*
+					 *  Have the daemon send the port queries
+					 *  now rather than at the next poll.
+					 */
+					if (ch->ch_state == CS_SEND_QUERY) {
+						nd->nd_tx_ready = 1;
+						wake_up_interruptible(&nd->nd_tx_waitq);
+					}
 				}
 				break;
 
@@ -3755,7 +4448,18 @@ open_error:
 						break;
 					}
 
+					/*
+					 *  Only this port's own sync is timed.
+					 *  Any earlier ones it acknowledges in
+					 *  passing belong to other ports.
+					 */
+					if (nd->nd_seq_stamp[seq])
+						dgrp_lat_end(ch, LAT_TX_ACK,
+							     &nd->nd_seq_stamp[seq], 0);
+
 					for (s = nd->nd_seq_out;; s = (s + 1) & SEQ_MASK) {
+						nd->nd_seq_stamp[s] = 0;
+
 						if (nd->nd_seq_wait[s] != 0) {
 							nd->nd_seq_wait[s] = 0;
 
@@ -3808,6 +4512,7 @@ open_error:
 
 				{
 					ch->ch_s_elast = dgrp_decode_u2(b + 2);
+					dgrp_modem_change(ch, ch->ch_s_mlast, b[4]);
 					ch->ch_s_mlast = b[4];
 
 					ch->ch_expect &= ~RR_STATUS;
@@ -3851,6 +4556,7 @@ open_error:
 
 					ch->ch_send   &= ~RR_BUFFER;
 					ch->ch_expect &= ~RR_BUFFER;
+					ch->ch_known  |= RR_BUFFER;
 				}
 				goto check_query;
 
@@ -3865,6 +4571,7 @@ open_error:
 				{
 					ch->ch_send   &= ~RR_CAPABILITY;
 					ch->ch_expect &= ~RR_CAPABILITY;
+					ch->ch_known  |= RR_CAPABILITY;
 				}
 
 			/*
@@ -3896,9 +4603,24 @@ check_query:
 					ch->ch_rlow  = 2 * ch->ch_s_rsize / 8;
 					ch->ch_rhigh = 6 * ch->ch_s_rsize / 8;
 
+					ch->ch_rwin_max = RBUF_MAX - 1;
+					ch->ch_rwin_rxcount = ch->ch_rxcount;
+					ch->ch_rwin_time = jiffies;
+
+					ch->ch_rx_avg = 0;
+					ch->ch_tx_avg = 0;
+					ch->ch_tx_tmax = ch->ch_tmax;
+					ch->ch_tx_ttime = ch->ch_ttime;
+
 					ch->ch_state = CS_READY;
 
+					/*
+					 *  Get any data the open left queued
+					 *  moving without waiting for a poll.
+					 */
 					nd->nd_tx_work = 1;
+					nd->nd_tx_ready = 1;
+					wake_up_interruptible(&nd->nd_tx_waitq);
 					wake_up_interruptible(&ch->ch_flag_wait);
 
 				}
@@ -3927,6 +4649,8 @@ check_query:
 			 *  Handle modem changes.
 			 */
 
+			dgrp_modem_change(ch, mlast, mstat);
+
 			if (((mstat ^ mlast) & DM_CD) != 0) {
 				dbg_net_trace(INPUT, ("calling carrier after"
 					" case 12, carrier detected\n"));
@@ -3938,6 +4662,9 @@ check_query:
 			 *  Handle received break.
 			 */
 
+			if ((estat & ~elast & EV_RXB) != 0)
+				ch->ch_icount.brk++;
+
 			if ((estat & ~elast & EV_RXB) != 0 &&
 			    (ch->ch_tun.un_open_count != 0) &&
 			    I_BRKINT(ch->ch_tun.un_tty) &&
@@ -4169,7 +4896,7 @@ check_query:
 
 				if (nd->nd_expect == 0 &&
 				    nd->nd_state == NS_WAIT_QUERY) {
-					nd->nd_state = NS_READY;
+					dgrp_net_state(nd, NS_READY);
 				}
 				break;
 
@@ -4263,7 +4990,7 @@ prot_error:
 	dbg_trace(("net receive: Sent Reset to node %s - %s\n", ID, error));
 
 	nd->nd_remain = 0;
-	nd->nd_state = NS_SEND_ERROR;
+	dgrp_net_state(nd, NS_SEND_ERROR);
 	nd->nd_error = error;
 }
 
@@ -4303,6 +5030,7 @@ static ssize_t dgrp_net_write(struct file *file, const char *buf, size_t count,
 	ssize_t rtn = 0;
 	long n;
 	long total = 0;
+	int staged;
 
 	dbg_net_trace(WRITE, ("net write(%p) start\n", file->private_data));
 
@@ -4380,11 +5108,27 @@ static ssize_t dgrp_net_write(struct file *file, const char *buf, size_t count,
 
 		count -= n;
 
-		if (nd->nd_mon_buf != 0) {
-			dgrp_monitor_data(nd, RPDUMP_SERVER,
-					nd->nd_iobuf + nd->nd_remain, n);
+		/*
+		 *  Readers filtering on ports need to know which ports
+		 *  the data touches, which dgrp_receive() finds out.  It
+		 *  also reuses nd_iobuf, so record a copy afterwards.
+		 */
+		staged = 0;
+
+		if (nd->nd_mon_count != 0) {
+			if (nd->nd_mon_portsel != 0 && nd->nd_mon_stage) {
+				memcpy(nd->nd_mon_stage,
+				       nd->nd_iobuf + nd->nd_remain, n);
+				staged = 1;
+			} else {
+				dgrp_monitor_data(nd, RPDUMP_SERVER,
+						nd->nd_iobuf + nd->nd_remain, n,
+						NULL);
+			}
 		}
 
+		bitmap_zero(nd->nd_mon_ports, CHAN_MAX);
+
 /* TODO : historical locking placeholder */
 /*
  *  In the HPUX version of the RealPort driver (which served as a basis
@@ -4398,6 +5142,10 @@ static ssize_t dgrp_net_write(struct file *file, const char *buf, size_t count,
 		nd->nd_remain += n;
 
 		dgrp_receive(nd);
+
+		if (staged)
+			dgrp_monitor_data(nd, RPDUMP_SERVER, nd->nd_mon_stage,
+					  n, nd->nd_mon_ports);
 	}
 
 	rtn = total;
@@ -4710,8 +5458,6 @@ static void poll_handler(struct timer_list *dummy)
 	ulong  freq;
 	ulong  lock_flags;
 
-	dbg_net_trace(POLL, ("net poll start time %d\n", jiffies));
-
 	freq = 1000 / dgrp_poll_tick;
 
 	poll_round += 17;
@@ -4894,11 +5640,10 @@ static void poll_handler(struct timer_list *dummy)
 		    (nd->nd_tx_work != 0 ||
 		    (ulong)(jiffies - nd->nd_tx_time) >= IDLE_MAX)) {
 
-			dbg_net_trace(POLL, ("net poll woke server(%p) "
-			   "credit=%d\n", nd, nd->nd_tx_credit));
-
 			nd->nd_tx_ready = 1;
 
+			trace_dgrp_poll_wake(nd);
+
 			wake_up_interruptible(&nd->nd_tx_waitq);
 
 			/* not needed */
@@ -55,6 +55,7 @@
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0)
 #include <linux/slab.h>
 #endif
+#include <linux/compat.h>
 
 #include "drp.h"
 #include "dgrp_common.h"
@@ -72,6 +73,10 @@ static int dgrp_ports_open(struct inode *, struct file *);
 static int dgrp_ports_release(struct inode *, struct file *);
 static ssize_t dgrp_ports_read(struct file *, char *, size_t, loff_t *);
 static ssize_t dgrp_ports_write(struct file *, const char *, size_t, loff_t *);
+static long dgrp_ports_ioctl(struct file *, unsigned int, unsigned long);
+#ifdef CONFIG_COMPAT
+static long dgrp_ports_compat_ioctl(struct file *, unsigned int, unsigned long);
+#endif
 
 
 /* Inode operation declarations */
@@ -87,6 +92,10 @@ static struct file_operations ports_ops = {
 	.owner   =   THIS_MODULE,	/* owner   */
 	.read    =   dgrp_ports_read,	/* read	   */
 	.write   =   dgrp_ports_write,	/* write   */
+	.unlocked_ioctl = dgrp_ports_ioctl,	/* ioctl   */
+#ifdef CONFIG_COMPAT
+	.compat_ioctl = dgrp_ports_compat_ioctl, /* 32-bit ioctl */
+#endif
 	.open    =   dgrp_ports_open,	/* open    */
 	.release =   dgrp_ports_release	/* release */
 };
@@ -98,6 +107,18 @@ static struct inode_operations ports_inode_ops = {
 #endif
 
 
+/*
+ * Read position of one open of a "ports" device.  Each open has its
+ * own, so readers no longer need to exclude each other.
+ */
+struct ports_cursor {
+	struct nd_struct *pc_nd;	/* Node being listed */
+	int	pc_ch;			/* Next channel to list */
+	int	pc_line;		/* Next line to compose */
+	int	pc_linepos;		/* Position in pc_linebuf */
+	char	pc_linebuf[81];		/* Line being returned */
+};
+
 
 
 /*****************************************************************************
@@ -154,8 +175,6 @@ int register_ports_device(struct nd_struct *node, struct proc_dir_entry *root)
 #endif
 
 	node->nd_ports_de = de;
-	sema_init(&node->nd_ports_semaphore, 1);
-	node->nd_ports_inuse = 0;
 
 	return 0;
 }
@@ -245,6 +264,7 @@ int unregister_ports_device(struct nd_struct *node, struct proc_dir_entry *root)
 static int dgrp_ports_open(struct inode *inode, struct file *file)
 {
 	struct nd_struct *nd;
+	struct ports_cursor *pc;
 	int rtn = 0;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
 	struct proc_dir_entry *de;
@@ -287,17 +307,15 @@ static int dgrp_ports_open(struct inode *inode, struct file *file)
 		goto done;
 	}
 
-	file->private_data = (void *) nd;
-
-	/* Enforce exclusive access to "ports" device */
-	down(&nd->nd_ports_semaphore);
+	pc = kzalloc(sizeof(struct ports_cursor), GFP_KERNEL);
+	if (!pc) {
+		rtn = -ENOMEM;
+		goto done;
+	}
 
-	if (nd->nd_ports_inuse)
-		rtn = -EBUSY;
-	else
-		nd->nd_ports_inuse++;
+	pc->pc_nd = nd;
 
-	up(&nd->nd_ports_semaphore);
+	file->private_data = (void *) pc;
 
 done:
 	dbg_ports_trace(OPEN, ("ports open(%p) return %d\n",
@@ -335,23 +353,18 @@ done:
 
 static int dgrp_ports_release(struct inode *inode, struct file *file)
 {
-	struct nd_struct *nd;
+	struct ports_cursor *pc;
 
 	dbg_ports_trace(CLOSE, ("ports close(%p) start\n", file->private_data));
 
 	/*
-	 *  Get the node pointer, and quit if it doesn't exist.
+	 *  Get the cursor, and quit if it doesn't exist.
 	 */
-	nd = (struct nd_struct *)(file->private_data);
-	if (!nd)
+	pc = (struct ports_cursor *)(file->private_data);
+	if (!pc)
 		goto done;
 
-	/* Enforce exclusivity of the "ports" device */
-	down(&nd->nd_ports_semaphore);
-
-	nd->nd_ports_inuse = 0;
-
-	up(&nd->nd_ports_semaphore);
+	kfree(pc);
 
 	dbg_ports_trace(CLOSE, ("ports close(%p) return\n",
 			file->private_data));
@@ -392,11 +405,8 @@ done:
 static ssize_t dgrp_ports_read(struct file *file, char *buf, size_t count, loff_t *ppos)
 {
 	struct nd_struct *nd;
-
-	static int currch = 0;
-	static int currline = 0;
-	static char linebuf[81];
-	static int linepos = 0;
+	struct ports_cursor *pc;
+	char *linebuf;
 
 	int len;
 	int left;
@@ -406,21 +416,25 @@ static ssize_t dgrp_ports_read(struct file *file, char *buf, size_t count, loff_
 	dbg_ports_trace(READ, ("ports read (%x)\n", file->private_data));
 
 	/*
-	 *  Get the node pointer, and quit if it doesn't exist.
+	 *  Get the cursor, and quit if it doesn't exist.
 	 */
-	nd = (struct nd_struct *)(file->private_data);
-	if (!nd) {
+	pc = (struct ports_cursor *)(file->private_data);
+	if (!pc) {
+		nd = NULL;
 		res = -ENXIO;
 		goto done;
 	}
 
+	nd = pc->pc_nd;
+	linebuf = pc->pc_linebuf;
+
 	/*
 	 *  Determine current position.
 	 */
 	if (*ppos == 0) {
-		currch = 0;
-		currline = 0;
-		linepos = 0;
+		pc->pc_ch = 0;
+		pc->pc_line = 0;
+		pc->pc_linepos = 0;
 		linebuf[0] = 0;
 	}
 
@@ -433,15 +447,15 @@ static ssize_t dgrp_ports_read(struct file *file, char *buf, size_t count, loff_
 	 *  If we are at the beginning of a line, compose
 	 *  the line.
 	 */
-	if (!linepos) {
+	if (!pc->pc_linepos) {
 		char tmp_id[20];
 
-		if (currch >= nd->nd_chan_count) {
+		if (pc->pc_ch >= nd->nd_chan_count) {
 			res = 0;
 			goto done;
 		}
 
-		switch (currline) {
+		switch (pc->pc_line) {
 		case 0:
 		case 7:
 			strcpy(linebuf, "#-----------------------------"
@@ -474,7 +488,7 @@ static ssize_t dgrp_ports_read(struct file *file, char *buf, size_t count, loff_
 				struct un_struct *tun, *pun;
 				unsigned int totcnt;
 
-				ch = &nd->nd_chan[currch];
+				ch = &nd->nd_chan[pc->pc_ch];
 				tun = &(ch->ch_tun);
 				pun = &(ch->ch_pun);
 
@@ -491,7 +505,7 @@ static ssize_t dgrp_ports_read(struct file *file, char *buf, size_t count, loff_
 
 				sprintf(linebuf, "%02d %02d %02d %02d "
 					"0x%04X 0x%04X 0x%04X 0x%04X "
-					"%-6d 0x%04X\n", currch,
+					"%-6d 0x%04X\n", pc->pc_ch,
 					tun->un_open_count,
 					pun->un_open_count,
 					ch->ch_wait_count[0] +
@@ -503,7 +517,7 @@ static ssize_t dgrp_ports_read(struct file *file, char *buf, size_t count, loff_
 					ch->ch_s_cflag,
 					(ch->ch_s_brate ? (1843200 / ch->ch_s_brate) : 0),
 					ch->ch_digi.digi_flags);
-				currch++;
+				pc->pc_ch++;
 				break;
 			}
 		}
@@ -511,7 +525,7 @@ static ssize_t dgrp_ports_read(struct file *file, char *buf, size_t count, loff_
 
 	notdone = 0;
 	left = count;
-	len = strlen(&linebuf[linepos]);
+	len = strlen(&linebuf[pc->pc_linepos]);
 
 	if (len > left) {
 		len = left;
@@ -523,7 +537,7 @@ static ssize_t dgrp_ports_read(struct file *file, char *buf, size_t count, loff_
 		goto done;
 	}
 
-	res = copy_to_user(buf, &linebuf[linepos], len);
+	res = copy_to_user(buf, &linebuf[pc->pc_linepos], len);
 
 	if (res) {
 		res = -EFAULT;
@@ -531,10 +545,10 @@ static ssize_t dgrp_ports_read(struct file *file, char *buf, size_t count, loff_
 	}
 
 	if (notdone)
-		linepos += len;
+		pc->pc_linepos += len;
 	else {
-		linepos = 0;
-		currline++;
+		pc->pc_linepos = 0;
+		pc->pc_line++;
 	}
 
 	res = len;
@@ -577,6 +591,178 @@ static ssize_t dgrp_ports_write(struct file *file, const char *buf, size_t count
 }
 
 
+/*
+ *  Fill in the binary status of one port.  The values are sampled
+ *  without stopping the node, as the text listing does.
+ */
+static void dgrp_portstat(struct nd_struct *nd, int port,
+			  struct digi_portstat *ps)
+{
+	struct ch_struct *ch = nd->nd_chan + port;
+	uint wait;
+
+	memset(ps, 0, sizeof(*ps));
+
+	wait = ch->ch_wait_count[0] + ch->ch_wait_count[1] +
+	       ch->ch_wait_count[2];
+
+	ps->ps_node = nd->nd_ID;
+	ps->ps_port = port;
+	ps->ps_node_state = (nd->nd_state == NS_READY) ? 1 : 0;
+	ps->ps_state = ch->ch_state;
+	ps->ps_flag = ch->ch_flag;
+	ps->ps_tty_open = ch->ch_tun.un_open_count;
+	ps->ps_pr_open = ch->ch_pun.un_open_count;
+	ps->ps_wait = wait;
+
+	/*
+	 * As in the text listing, the modem signals of a port that no
+	 * one has open or is waiting to open can't be trusted.
+	 */
+	if (ps->ps_tty_open + ps->ps_pr_open + wait)
+		ps->ps_mstat = ch->ch_s_mlast;
+
+	ps->ps_iflag = ch->ch_s_iflag;
+	ps->ps_oflag = ch->ch_s_oflag;
+	ps->ps_cflag = ch->ch_s_cflag;
+	ps->ps_xflag = ch->ch_s_xflag;
+	ps->ps_bps = ch->ch_s_brate ? (1843200 / ch->ch_s_brate) : 0;
+	ps->ps_digi_flags = ch->ch_digi.digi_flags;
+	ps->ps_txq = (ch->ch_tin - ch->ch_tout) & TBUF_MASK;
+	ps->ps_rxq = (ch->ch_rin - ch->ch_rout) & RBUF_MASK;
+	ps->ps_txcount = ch->ch_txcount;
+	ps->ps_rxcount = ch->ch_rxcount;
+	ps->ps_cts = ch->ch_icount.cts;
+	ps->ps_dsr = ch->ch_icount.dsr;
+	ps->ps_rng = ch->ch_icount.rng;
+	ps->ps_dcd = ch->ch_icount.dcd;
+	ps->ps_frame = ch->ch_icount.frame;
+	ps->ps_parity = ch->ch_icount.parity;
+	ps->ps_brk = ch->ch_icount.brk;
+	ps->ps_overrun = ch->ch_icount.overrun;
+}
+
+
+/*
+ *  Copy the status of a node's ports to user space, starting at entry
+ *  *total of the caller's array, which has room for count entries.
+ *  *total is advanced past every port, whether or not it fitted.
+ */
+static int dgrp_ports_snap(struct nd_struct *nd, struct digi_portstat __user *ups,
+			   uint count, uint *total)
+{
+	struct digi_portstat ps;
+	int i;
+
+	for (i = 0; i < nd->nd_chan_count; i++, (*total)++) {
+		if (*total >= count)
+			continue;
+
+		dgrp_portstat(nd, i, &ps);
+
+		if (copy_to_user(ups + *total, &ps, sizeof(ps)))
+			return -EFAULT;
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+*
+* Function:
+*
+*    dgrp_ports_ioctl
+*
+* Author:
+*
+*    James A. Puzzo
+*
+* Parameters:
+*
+*    file, cmd, arg (standard Linux ioctl arguments)
+*
+* Return Values:
+*
+*    0 on success, else a negative errno
+*
+* Description:
+*
+*    DIGI_GETPORTSNAP returns the binary status of every port on this
+*    node, or with PORTSNAP_ALL on every node, in a single call, so
+*    monitoring tools need not parse the text listing line by line.
+*
+******************************************************************************/
+
+static long dgrp_ports_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct ports_cursor *pc = file->private_data;
+	void __user *uarg = (void __user *) arg;
+	struct digi_portstat __user *ups;
+	struct digi_portsnap snap;
+	struct nd_struct *nd;
+	uint total = 0;
+	int rtn = 0;
+
+	if (!pc)
+		return -ENXIO;
+
+	switch (cmd) {
+	case DIGI_GETPORTSNAP:
+		if (copy_from_user(&snap, uarg, sizeof(snap)))
+			return -EFAULT;
+
+		if (snap.sn_version != PORTSNAP_VERSION)
+			return -EINVAL;
+
+		if (snap.sn_flags & ~PORTSNAP_ALL)
+			return -EINVAL;
+
+		ups = (struct digi_portstat __user *)(unsigned long) snap.sn_ports;
+
+		if (snap.sn_flags & PORTSNAP_ALL) {
+			down(&nd_struct_semaphore);
+
+			for (nd = head_nd_struct; nd && !rtn; nd = nd->nd_inext)
+				rtn = dgrp_ports_snap(nd, ups, snap.sn_count, &total);
+
+			up(&nd_struct_semaphore);
+		} else {
+			rtn = dgrp_ports_snap(pc->pc_nd, ups, snap.sn_count, &total);
+		}
+
+		if (rtn)
+			return rtn;
+
+		snap.sn_total = total;
+		if (snap.sn_count > total)
+			snap.sn_count = total;
+
+		if (copy_to_user(uarg, &snap, sizeof(snap)))
+			return -EFAULT;
+		break;
+
+	default:
+		return -ENOTTY;
+	}
+
+	return 0;
+}
+
+
+#ifdef CONFIG_COMPAT
+/*
+ * struct digi_portsnap has the same layout for 32-bit callers, with
+ * sn_ports carried as a 64-bit value, so only arg needs converting.
+ */
+static long dgrp_ports_compat_ioctl(struct file *file, unsigned int cmd,
+				    unsigned long arg)
+{
+	return dgrp_ports_ioctl(file, cmd, (unsigned long) compat_ptr(arg));
+}
+#endif
+
+
 
 /*****************************************************************************
 *
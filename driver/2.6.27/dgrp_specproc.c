@@ -42,6 +42,7 @@
 #include <linux/cred.h>
 
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,10,0)
 #include <linux/slab.h>
 #endif
@@ -61,7 +62,7 @@ static struct dgrp_proc_entry dgrp_table[];
 /* File operation declarations */
 static int dgrp_gen_proc_open(struct inode *, struct file *);
 static int dgrp_gen_proc_close(struct inode *, struct file *);
-static ssize_t dgrp_gen_proc_read(struct file *, char *, size_t, loff_t *);
+static loff_t dgrp_gen_proc_llseek(struct file *, loff_t, int);
 static ssize_t dgrp_gen_proc_write(struct file *, const char *, size_t, loff_t *);
 static int parse_write_config(char *);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
@@ -74,7 +75,8 @@ static int proc_chk_perm(struct inode *, int);
 
 struct file_operations dgrp_proc_file_ops = {
 	.owner   = THIS_MODULE,		/* owner	*/
-	.read    = dgrp_gen_proc_read,	/* read		*/
+	.read    = seq_read,		/* read		*/
+	.llseek  = dgrp_gen_proc_llseek,	/* llseek	*/
 	.write   = dgrp_gen_proc_write,	/* write	*/
 	.open    = dgrp_gen_proc_open,	/* open		*/
 	.release = dgrp_gen_proc_close,	/* release	*/
@@ -96,19 +98,19 @@ static struct dgrp_proc_entry dgrp_ports_table[];
 static struct dgrp_proc_entry dgrp_dpa_table[];
 
 static dgrp_proc_handler write_config;
-static dgrp_proc_handler read_config;
+static const struct seq_operations config_seq_ops;
 
 static dgrp_proc_handler write_info;
-static dgrp_proc_handler read_info;
+static const struct seq_operations info_seq_ops;
 
-static dgrp_proc_handler read_nodeinfo;
+static const struct seq_operations nodeinfo_seq_ops;
 
 static struct dgrp_proc_entry dgrp_table[] = {
-	{DGRP_CONFIG,   "config", 0644, NULL, &read_config, &write_config,
+	{DGRP_CONFIG,   "config", 0644, NULL, &config_seq_ops, &write_config,
 			NULL, __SEMAPHORE_INITIALIZER(dgrp_table[0].excl_sem, 1), 0},
-	{DGRP_INFO,     "info", 0644, NULL, &read_info, &write_info,
+	{DGRP_INFO,     "info", 0644, NULL, &info_seq_ops, &write_info,
 			NULL, __SEMAPHORE_INITIALIZER(dgrp_table[1].excl_sem, 1), 0},
-	{DGRP_NODEINFO, "nodeinfo", 0644, NULL, &read_nodeinfo, NULL,
+	{DGRP_NODEINFO, "nodeinfo", 0644, NULL, &nodeinfo_seq_ops, NULL,
 			NULL, __SEMAPHORE_INITIALIZER(dgrp_table[2].excl_sem, 1), 0},
 	{DGRP_NETDIR,   "net",   0500, dgrp_net_table},
 	{DGRP_MONDIR,   "mon",   0500, dgrp_mon_table},
@@ -208,7 +210,7 @@ static void register_proc_table(struct dgrp_proc_entry *table,
 		if (!table->name)
 			continue;
 		/* Maybe we can't do anything with it... */
-		if (!table->read_handler && !table->write_handler &&
+		if (!table->seq_ops && !table->write_handler &&
 		    !table->child) {
 			printk(KERN_WARNING "DGRP PROC: Can't register %s\n",
 				table->name);
@@ -348,7 +350,7 @@ static void register_proc_table(struct dgrp_proc_entry *table,
 		if (!table->name)
 			continue;
 		/* Maybe we can't do anything with it... */
-		if (!table->read_handler && !table->write_handler &&
+		if (!table->seq_ops && !table->write_handler &&
 		    !table->child) {
 			printk(KERN_WARNING "DGRP PROC: Can't register %s\n",
 				table->name);
@@ -470,24 +472,53 @@ static int dgrp_gen_proc_open(struct inode *inode, struct file *file)
 		goto done;
 	}
 
-	down(&entry->excl_sem);
+	/*
+	 *  Hold the module first, so nothing below has to be undone
+	 *  if that fails.
+	 */
+	if (!try_module_get(THIS_MODULE)) {
+		ret = -ENXIO;
+		goto done;
+	}
 
-	if (entry->excl_cnt)
-		ret = -EBUSY;
-	else
-		entry->excl_cnt++;
+	/*
+	 *  Readers each get a private seq_file iterator.  Only the write
+	 *  handlers keep state across calls, so only writers are exclusive.
+	 */
+	if (file->f_mode & FMODE_WRITE) {
+		down(&entry->excl_sem);
 
-	up(&entry->excl_sem);
+		if (entry->excl_cnt)
+			ret = -EBUSY;
+		else
+			entry->excl_cnt++;
 
-done:
-	if (!ret) {
-		ret = try_module_get(THIS_MODULE);
-		if (!ret)
+		up(&entry->excl_sem);
+
+		if (ret)
+			goto put;
+	}
+
+	if (file->f_mode & FMODE_READ) {
+		/* Test for read permission */
+		if (test_perm(entry->mode, 4))
+			ret = -EPERM;
+		else if (!entry->seq_ops)
 			ret = -ENXIO;
 		else
-			ret = 0;
+			ret = seq_open(file, entry->seq_ops);
+
+		if (ret && (file->f_mode & FMODE_WRITE)) {
+			down(&entry->excl_sem);
+			entry->excl_cnt = 0;
+			up(&entry->excl_sem);
+		}
 	}
 
+put:
+	if (ret)
+		module_put(THIS_MODULE);
+done:
 	return ret;
 }
 
@@ -513,57 +544,33 @@ static int dgrp_gen_proc_close(struct inode *inode, struct file *file)
 	if (!entry)
 		goto done;
 
-	down(&entry->excl_sem);
+	if (file->f_mode & FMODE_READ)
+		seq_release(inode, file);
 
-	if (entry->excl_cnt)
-		entry->excl_cnt = 0;
+	if (file->f_mode & FMODE_WRITE) {
+		down(&entry->excl_sem);
 
-	up(&entry->excl_sem);
+		if (entry->excl_cnt)
+			entry->excl_cnt = 0;
+
+		up(&entry->excl_sem);
+	}
 
 done:
 	module_put(THIS_MODULE);
 	return 0;
 }
 
-static ssize_t dgrp_gen_proc_read(struct file *file, char *buf, size_t count, loff_t *ppos)
+/*
+ *  Write-only opens have no seq_file behind them, so only hand
+ *  seeks to seq_lseek() when the file was opened for reading.
+ */
+static loff_t dgrp_gen_proc_llseek(struct file *file, loff_t offset, int whence)
 {
-	struct dgrp_proc_entry *entry;
-	dgrp_proc_handler *handler;
-	ssize_t res;
-	ssize_t error;
-
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
-	struct proc_dir_entry *de;
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,9,0)
-	de = (struct proc_dir_entry *) PDE(file->f_dentry->d_inode);
-#else
-	de = (struct proc_dir_entry *) PDE(file_inode(file));
-#endif
-	if (!de || !de->data)
-		return -ENXIO;
-
-	entry = (struct dgrp_proc_entry *) de->data;
-#else /* >=3,10,0 */
-	entry = (struct dgrp_proc_entry *) PDE_DATA(file_inode(file));
-#endif
-	if (!entry)
-		return -ENXIO;
-
-	/* Test for read permission */
-	if (test_perm(entry->mode, 4))
-		return -EPERM;
-
-	res = count;
-
-	handler = entry->read_handler;
-	if (!handler)
-		return -ENXIO;
+	if (file->f_mode & FMODE_READ)
+		return seq_lseek(file, offset, whence);
 
-	error = (*handler) (entry, OUTBOUND, file, buf, &res, ppos);
-	if (error)
-		return error;
-
-	return res;
+	return default_llseek(file, offset, whence);
 }
 
 static ssize_t dgrp_gen_proc_write(struct file *file, const char *buf, size_t count, loff_t *ppos)
@@ -664,91 +671,85 @@ static int write_config(struct dgrp_proc_entry *table, int dir,
 	return retval;
 }
 
-static int read_config(struct dgrp_proc_entry *table, int dir,
-			struct file *filp, void *buffer,
-			ssize_t *lenp, loff_t *ppos)
+/*
+ *  The "config" and "nodeinfo" entries list one line per node after a
+ *  fixed header, which is produced for SEQ_START_TOKEN.  The node list
+ *  is walked holding nd_struct_semaphore, so nodes cannot be added or
+ *  deleted while seq_read() is filling a buffer.  Nothing at all is
+ *  listed when no nodes are configured.
+ */
+static void *dgrp_nodes_start(struct seq_file *m, loff_t *pos)
 {
-	static struct nd_struct *curr_ps = NULL;
-	static int currline = 0;
-	static char linebuf[81];
-	static int linepos = 0;
+	struct nd_struct *nd;
+	loff_t n = *pos;
 
-	int len;
-	int left;
-	int notdone;
+	down(&nd_struct_semaphore);
 
-	if (*ppos == 0) {
-		curr_ps = head_nd_struct;
-		currline = 0;
-		linepos = 0;
-		linebuf[0] = 0;
-	}
+	if (!head_nd_struct)
+		return NULL;
 
-	if ((!*lenp) || (dir != OUTBOUND) || (!curr_ps)) {
-		*lenp = 0;
-		return 0;
-	}
+	if (!n)
+		return SEQ_START_TOKEN;
 
-	/* Compose the next line if we are pointing to the beginning */
-	if (!linepos) {
-		char tmp_id[20];
+	for (nd = head_nd_struct; nd && --n; nd = nd->nd_inext)
+		;
 
-		switch (currline) {
-		case 0:
-		case 3:
-			strcpy(linebuf, "#---------------------------------"
-					"----------------------------------"
-					"----------\n");
-			break;
-		case 1:
-			strcpy(linebuf, "#                        Avail\n");
-			break;
-		case 2:
-			strcpy(linebuf, "# ID  Major  State       Ports\n");
-			break;
-		default:
-			ID_TO_CHAR(curr_ps->nd_ID, tmp_id);
-/*
-					"#                        Avail\n"
-					"# ID  Major  State       Ports\n"
-					"  xx  99999  xxxxxxxxxx  99999\n"
-*/
-			sprintf(linebuf, "  %-2.2s  %-5ld  %-10.10s  %-5d\n",
-				tmp_id, curr_ps->nd_major,
-				ND_STATE_STR(curr_ps->nd_state),
-				curr_ps->nd_chan_count);
+	return nd;
+}
 
-			curr_ps = curr_ps->nd_inext;
-		}
-	}
+static void *dgrp_nodes_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
 
-	notdone = 0;
-	left = *lenp;
-	len = strlen(&linebuf[linepos]);
+	if (v == SEQ_START_TOKEN)
+		return head_nd_struct;
 
-	if (len > left) {
-		len = left;
-		notdone = 1;
-	}
+	return ((struct nd_struct *) v)->nd_inext;
+}
 
-	if (access_ok(VERIFY_WRITE, buffer, len) == 0)
-		return -EFAULT;
-	if (copy_to_user(buffer, &linebuf[linepos], len))
-		return -EFAULT;
+static void dgrp_nodes_stop(struct seq_file *m, void *v)
+{
+	up(&nd_struct_semaphore);
+}
 
-	if (notdone)
-		linepos += len;
-	else {
-		linepos = 0;
-		currline++;
+static int config_show(struct seq_file *m, void *v)
+{
+	struct nd_struct *nd = v;
+	char tmp_id[20];
+
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(m, "#---------------------------------"
+			    "----------------------------------"
+			    "----------\n"
+			    "#                        Avail\n"
+			    "# ID  Major  State       Ports\n"
+			    "#---------------------------------"
+			    "----------------------------------"
+			    "----------\n");
+		return 0;
 	}
 
-	*lenp = len;
-	*ppos += len;
+	ID_TO_CHAR(nd->nd_ID, tmp_id);
+/*
+			"#                        Avail\n"
+			"# ID  Major  State       Ports\n"
+			"  xx  99999  xxxxxxxxxx  99999\n"
+*/
+	seq_printf(m, "  %-2.2s  %-5ld  %-10.10s  %-5d\n",
+		   tmp_id, nd->nd_major,
+		   ND_STATE_STR(nd->nd_state),
+		   nd->nd_chan_count);
 
 	return 0;
 }
 
+static const struct seq_operations config_seq_ops = {
+	.start = dgrp_nodes_start,
+	.next  = dgrp_nodes_next,
+	.stop  = dgrp_nodes_stop,
+	.show  = config_show,
+};
+
 
 /*
  *  ------------------------------------------------------------------------
@@ -832,11 +833,12 @@ static int parse_add_config(char *buf)
 
 	new_nd->nd_major = 0;
 	new_nd->nd_ID = ID;
+	new_nd->nd_hold_bytes = HOLD_BYTES_DEF;
 
 	spin_lock_init(&new_nd->nd_lock);
 
 	init_waitqueue_head(&(new_nd->nd_tx_waitq));
-	init_waitqueue_head(&(new_nd->nd_mon_wqueue));
+	INIT_LIST_HEAD(&new_nd->nd_mon_list);
 	init_waitqueue_head(&(new_nd->nd_dpa_wqueue));
 	for (i = 0; i < SEQ_MAX; i++)
 		init_waitqueue_head(&(new_nd->nd_seq_wque[i]));
@@ -859,7 +861,9 @@ static int parse_add_config(char *buf)
 	dbg_comm_trace(INIT, ("XPR major: %d\n",
 			new_nd->nd_xprint_ttdriver->major));
 
+	down(&nd_struct_semaphore);
 	retval = nd_struct_add(new_nd);
+	up(&nd_struct_semaphore);
 	if (retval) {
 		kfree(new_nd);
 		return retval;
@@ -919,7 +923,9 @@ static int parse_del_config(char *buf)
 
 	dgrp_tty_uninit(nd);
 
+	down(&nd_struct_semaphore);
 	retval = nd_struct_del(nd);
+	up(&nd_struct_semaphore);
 	if (retval)
 		return retval;
 
@@ -1004,7 +1010,7 @@ typedef enum {
 	INFO_LONG, INFO_PTR, INFO_STRING, END
 } info_proc_var_val;
 
-static struct {
+static struct info_var {
 	char              *name;
 	info_proc_var_val  type;
 	int                rw;       /* 0=readonly */
@@ -1221,232 +1227,162 @@ static int write_info(struct dgrp_proc_entry *table, int dir,
 
 /*
  *  Return what is (hopefully) useful information about the
- *  driver.  For now, the returned format is built line by
- *  line, like other /proc entry points implemented in this
- *  driver.  I _could_ have used the simple read, but I
- *  did not.
+ *  driver, one line per entry of info_vars[].  Unnamed entries
+ *  produce blank separator lines.
  */
 
-static int read_info(struct dgrp_proc_entry *table, int dir,
-			struct file *filp, void *buffer,
-			ssize_t *lenp, loff_t *ppos)
-{
-	static int currline = 0;
-	static char linebuf[81];
-	static int linepos = 0;
+static int info_maxnamelen = -1;
 
-	static int maxnamelen = -1;
-
-	int len;
-	int left;
-	int notdone;
-
-	if (maxnamelen == -1) {
+static void *info_start(struct seq_file *m, loff_t *pos)
+{
+	if (info_maxnamelen == -1) {
 		int i;
+		int maxnamelen = 0;
 
-		maxnamelen = 0;
 		for (i = 0; info_vars[i].type != END; i++) {
 			if (info_vars[i].name &&
 			    (strlen(info_vars[i].name) > maxnamelen))
 				maxnamelen = strlen(info_vars[i].name);
 		}
+		info_maxnamelen = maxnamelen;
 	}
 
-	if (*ppos == 0) {
-		currline = 0;
-		linepos = 0;
-		linebuf[0] = 0;
-	}
+	if (*pos >= ARRAY_SIZE(info_vars) || info_vars[*pos].type == END)
+		return NULL;
 
-	if ((!*lenp) || (dir != OUTBOUND) ||
-	    (info_vars[currline].type == END)) {
-		*lenp = 0;
-		return 0;
-	}
+	return &info_vars[*pos];
+}
 
-	/* Compose the next line if we are pointing to the beginning */
-	if (!linepos) {
-		int padlen;
+static void *info_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
 
-		if (info_vars[currline].name)
-			padlen = maxnamelen - strlen(info_vars[currline].name) + 2;
-		else
-			padlen = maxnamelen + 2;
-
-		switch (info_vars[currline].type) {
-		case INFO_CHAR:
-			sprintf(linebuf, "%s:%*s0x%02x\t(%d)\n",
-				info_vars[currline].name, padlen, "",
-				*(char *) (info_vars[currline].val_ptr),
-				*(char *) (info_vars[currline].val_ptr));
-			break;
-		case INFO_INT:
-			sprintf(linebuf, "%s:%*s0x%08x\t(%d)\n",
-				info_vars[currline].name, padlen, "",
-				*(int *) (info_vars[currline].val_ptr),
-				*(int *) (info_vars[currline].val_ptr));
-			break;
-		case INFO_SHORT:
-			sprintf(linebuf, "%s:%*s0x%04x\t(%d)\n",
-				info_vars[currline].name, padlen, "",
-				*(short *) (info_vars[currline].val_ptr),
-				*(short *) (info_vars[currline].val_ptr));
-			break;
-		case INFO_LONG:
-			sprintf(linebuf, "%s:%*s0x%0*lx\t(%ld)\n",
-				info_vars[currline].name, padlen, "",
-				(int) sizeof(long) * 2,
-				*(long *) (info_vars[currline].val_ptr),
-				*(long *) (info_vars[currline].val_ptr));
-			break;
-		case INFO_PTR:
-			sprintf(linebuf, "%s:%*s0x%0*lx\n",
-				info_vars[currline].name, padlen, "",
-				(int) sizeof(ulong) * 2,
-				*(ulong *) (info_vars[currline].val_ptr));
-			break;
-		case INFO_STRING:
-			sprintf(linebuf, "%s:%*s%s\n",
-				info_vars[currline].name, padlen, "",
-				(char *) info_vars[currline].val_ptr);
-			break;
-		default:
-			strcpy(linebuf, "\n");
-		}
-	}
+	return info_start(m, pos);
+}
 
-	notdone = 0;
-	left = *lenp;
-	len = strlen(&linebuf[linepos]);
+static void info_stop(struct seq_file *m, void *v)
+{
+}
 
-	if (len > left) {
-		len = left;
-		notdone = 1;
-	}
+static int info_show(struct seq_file *m, void *v)
+{
+	struct info_var *iv = v;
+	int padlen;
 
-	if (access_ok(VERIFY_WRITE, buffer, len) == 0)
-		return -EFAULT;
-	if (copy_to_user(buffer, &linebuf[linepos], len))
-		return -EFAULT;
+	if (iv->name)
+		padlen = info_maxnamelen - strlen(iv->name) + 2;
+	else
+		padlen = info_maxnamelen + 2;
 
-	if (notdone)
-		linepos += len;
-	else {
-		linepos = 0;
-		currline++;
+	switch (iv->type) {
+	case INFO_CHAR:
+		seq_printf(m, "%s:%*s0x%02x\t(%d)\n",
+			   iv->name, padlen, "",
+			   *(char *) (iv->val_ptr),
+			   *(char *) (iv->val_ptr));
+		break;
+	case INFO_INT:
+		seq_printf(m, "%s:%*s0x%08x\t(%d)\n",
+			   iv->name, padlen, "",
+			   *(int *) (iv->val_ptr),
+			   *(int *) (iv->val_ptr));
+		break;
+	case INFO_SHORT:
+		seq_printf(m, "%s:%*s0x%04x\t(%d)\n",
+			   iv->name, padlen, "",
+			   *(short *) (iv->val_ptr),
+			   *(short *) (iv->val_ptr));
+		break;
+	case INFO_LONG:
+		seq_printf(m, "%s:%*s0x%0*lx\t(%ld)\n",
+			   iv->name, padlen, "",
+			   (int) sizeof(long) * 2,
+			   *(long *) (iv->val_ptr),
+			   *(long *) (iv->val_ptr));
+		break;
+	case INFO_PTR:
+		seq_printf(m, "%s:%*s0x%0*lx\n",
+			   iv->name, padlen, "",
+			   (int) sizeof(ulong) * 2,
+			   *(ulong *) (iv->val_ptr));
+		break;
+	case INFO_STRING:
+		seq_printf(m, "%s:%*s%s\n",
+			   iv->name, padlen, "",
+			   (char *) iv->val_ptr);
+		break;
+	default:
+		seq_putc(m, '\n');
 	}
 
-	*lenp = len;
-	*ppos += len;
-
 	return 0;
 }
 
+static const struct seq_operations info_seq_ops = {
+	.start = info_start,
+	.next  = info_next,
+	.stop  = info_stop,
+	.show  = info_show,
+};
+
 
 /*
  *  Return detailed information about the nodes, including
  *  versions and descriptions.
  */
 
-static int read_nodeinfo(struct dgrp_proc_entry *table, int dir,
-			struct file *filp, void *buffer,
-			ssize_t *lenp, loff_t *ppos)
+static int nodeinfo_show(struct seq_file *m, void *v)
 {
-	static struct nd_struct *curr_ps = NULL;
-	static int currline = 0;
-	static char linebuf[82];	/* 80 chars + '\n' + '\0' */
-	static int linepos = 0;
-
+	struct nd_struct *nd = v;
+	char tmp_id[20];
 	char hwver[8];
 	char swver[8];
 
-	int len;
-	int left;
-	int notdone;
-
-	if (*ppos == 0) {
-		curr_ps = head_nd_struct;
-		currline = 0;
-		linepos = 0;
-		linebuf[0] = 0;
-	}
-
-	if ((!*lenp) || (dir != OUTBOUND) || (!curr_ps)) {
-		*lenp = 0;
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(m, "#---------------------------------"
+			    "----------------------------------"
+			    "------------\n"
+			    "#                 HW       HW   SW"
+			    "                                     OpenCount\n"
+			    "# ID  State       Version  ID   Version  "
+			    "Description                          ||\n"
+			    "#---------------------------------"
+			    "----------------------------------"
+			    "------------\n");
 		return 0;
 	}
 
-	/* Compose the next line if we are pointing to the beginning */
-	if (!linepos) {
-		char tmp_id[20];
-
-		switch (currline) {
-		case 0:
-		case 3:
-			strcpy(linebuf, "#---------------------------------"
-					"----------------------------------"
-					"------------\n");
-			break;
-		case 1:
-			strcpy(linebuf, "#                 HW       HW   SW"
-					"                                     OpenCount\n");
-			break;
-		case 2:
-			strcpy(linebuf, "# ID  State       Version  ID   Version  "
-					"Description                          ||\n");
-			break;
-		default:
-			ID_TO_CHAR(curr_ps->nd_ID, tmp_id);
-
-			if (curr_ps->nd_state == NS_READY) {
-				sprintf(hwver, "%d.%d", (curr_ps->nd_hw_ver >> 8) & 0xff,
-					curr_ps->nd_hw_ver & 0xff);
-				sprintf(swver, "%d.%d", (curr_ps->nd_sw_ver >> 8) & 0xff,
-					curr_ps->nd_sw_ver & 0xff);
-
-				sprintf(linebuf,
-					"  %-2.2s  %-10.10s  %-7.7s  %-3d  %-7.7s  %-35.35s  %02d\n",
-					tmp_id,
-					ND_STATE_STR(curr_ps->nd_state),
-					hwver,
-					curr_ps->nd_hw_id <= 999? curr_ps->nd_hw_id : 999,
-					swver, curr_ps->nd_ps_desc,
-					curr_ps->nd_open_count <= 99? curr_ps->nd_open_count : 99);
-			} else {
-				sprintf(linebuf, "  %-2.2s  %-10.10s  %-60.60s%02d\n",
-					tmp_id,
-					ND_STATE_STR(curr_ps->nd_state),
-					" ",
-					curr_ps->nd_open_count <= 99? curr_ps->nd_open_count : 99
-					);
-			}
-			curr_ps = curr_ps->nd_inext;
-		}
-	}
-
-	notdone = 0;
-	left = *lenp;
-	len = strlen(&linebuf[linepos]);
-
-	if (len > left) {
-		len = left;
-		notdone = 1;
-	}
-
-	if (access_ok(VERIFY_WRITE, buffer, len) == 0)
-		return -EFAULT;
-	if (copy_to_user(buffer, &linebuf[linepos], len))
-		return -EFAULT;
-
-	if (notdone)
-		linepos += len;
-	else {
-		linepos = 0;
-		currline++;
+	ID_TO_CHAR(nd->nd_ID, tmp_id);
+
+	if (nd->nd_state == NS_READY) {
+		sprintf(hwver, "%d.%d", (nd->nd_hw_ver >> 8) & 0xff,
+			nd->nd_hw_ver & 0xff);
+		sprintf(swver, "%d.%d", (nd->nd_sw_ver >> 8) & 0xff,
+			nd->nd_sw_ver & 0xff);
+
+		seq_printf(m,
+			"  %-2.2s  %-10.10s  %-7.7s  %-3d  %-7.7s  %-35.35s  %02d\n",
+			tmp_id,
+			ND_STATE_STR(nd->nd_state),
+			hwver,
+			nd->nd_hw_id <= 999? nd->nd_hw_id : 999,
+			swver, nd->nd_ps_desc,
+			nd->nd_open_count <= 99? nd->nd_open_count : 99);
+	} else {
+		seq_printf(m, "  %-2.2s  %-10.10s  %-60.60s%02d\n",
+			tmp_id,
+			ND_STATE_STR(nd->nd_state),
+			" ",
+			nd->nd_open_count <= 99? nd->nd_open_count : 99
+			);
 	}
 
-	*lenp = len;
-	*ppos += len;
-
 	return 0;
 }
+
+static const struct seq_operations nodeinfo_seq_ops = {
+	.start = dgrp_nodes_start,
+	.next  = dgrp_nodes_next,
+	.stop  = dgrp_nodes_stop,
+	.show  = nodeinfo_show,
+};
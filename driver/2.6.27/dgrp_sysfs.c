@@ -59,6 +59,32 @@ static struct class *dgrp_class;
 struct device *dgrp_class_nodes_dev;
 struct device *dgrp_class_global_settings_dev;
 
+/*
+ *  Formats a set of LAT_* histograms, one stage per line, each
+ *  followed by its LAT_BUCKETS log2 microsecond bucket counts.
+ */
+static ssize_t dgrp_lat_show(char *buf, struct lat_hist *lat)
+{
+	static const char *names[LAT_MAX] = {
+		[LAT_TX_QUEUE]	= "tx_queue",
+		[LAT_TX_ACK]	= "tx_ack",
+		[LAT_RX_PUSH]	= "rx_push",
+	};
+	int len = 0;
+	int i, j;
+
+	for (i = 0; i < LAT_MAX; i++) {
+		len += snprintf(buf + len, PAGE_SIZE - len, "%s", names[i]);
+		for (j = 0; j < LAT_BUCKETS; j++)
+			len += snprintf(buf + len, PAGE_SIZE - len, " %u",
+					lat[i].lh_count[j]);
+		len += snprintf(buf + len, PAGE_SIZE - len, "\n");
+	}
+
+	return len;
+}
+
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,35)
 static ssize_t dgrp_class_version_show(struct class *class, char *buf)
 {
@@ -101,6 +127,47 @@ static ssize_t dgrp_class_pollrate_store(struct device *c, struct device_attribu
 static DEVICE_ATTR(pollrate, 0600, dgrp_class_pollrate_show, dgrp_class_pollrate_store);
 
 
+static ssize_t dgrp_class_rwin_autotune_show(struct device *c, struct device_attribute *attr, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", GLBL(rwin_autotune));
+}
+static ssize_t dgrp_class_rwin_autotune_store(struct device *c, struct device_attribute *attr, const char *buf, size_t count)
+{
+	sscanf(buf, "%d\n", &(GLBL(rwin_autotune)));
+	return count;
+}
+static DEVICE_ATTR(rwin_autotune, 0600, dgrp_class_rwin_autotune_show, dgrp_class_rwin_autotune_store);
+
+
+static ssize_t dgrp_class_mon_size_show(struct device *c, struct device_attribute *attr, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", GLBL(mon_size));
+}
+static ssize_t dgrp_class_mon_size_store(struct device *c, struct device_attribute *attr, const char *buf, size_t count)
+{
+	int val;
+
+	if (sscanf(buf, "%d\n", &val) != 1 || val < MON_MIN || val > MON_LIMIT)
+		return -EINVAL;
+
+	GLBL(mon_size) = val;
+	return count;
+}
+static DEVICE_ATTR(mon_size, 0600, dgrp_class_mon_size_show, dgrp_class_mon_size_store);
+
+
+static ssize_t dgrp_class_latency_show(struct device *c, struct device_attribute *attr, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%d\n", GLBL(latency));
+}
+static ssize_t dgrp_class_latency_store(struct device *c, struct device_attribute *attr, const char *buf, size_t count)
+{
+	sscanf(buf, "%d\n", &(GLBL(latency)));
+	return count;
+}
+static DEVICE_ATTR(latency, 0600, dgrp_class_latency_show, dgrp_class_latency_store);
+
+
 static ssize_t dgrp_class_mon_debug_show(struct device *c, struct device_attribute *attr, char *buf)
 {
 	return snprintf(buf, PAGE_SIZE, "0x%lx\n", GLBL(mon_debug));
@@ -163,6 +230,9 @@ static DEVICE_ATTR(ports_debug, 0600, dgrp_class_ports_debug_show, dgrp_class_po
 static struct attribute *dgrp_sysfs_global_settings_entries[] = {
 	&dev_attr_pollrate.attr,
 	&dev_attr_rawreadok.attr,
+	&dev_attr_rwin_autotune.attr,
+	&dev_attr_mon_size.attr,
+	&dev_attr_latency.attr,
 	&dev_attr_mon_debug.attr,
 	&dev_attr_net_debug.attr,
 	&dev_attr_tty_debug.attr,
@@ -319,6 +389,131 @@ static ssize_t dgrp_node_sw_version_show(struct device *c, struct device_attribu
 static DEVICE_ATTR(sw_version_info, 0600, dgrp_node_sw_version_show, NULL);
 
 
+static ssize_t dgrp_node_hold_time_show(struct device *c, struct device_attribute *attr, char *buf)
+{
+	struct nd_struct *nd;
+
+	if (!c)
+		return 0;
+	nd = (struct nd_struct *) dev_get_drvdata(c);
+	if (!nd)
+		return 0;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", nd->nd_hold_time);
+}
+static ssize_t dgrp_node_hold_time_store(struct device *c, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct nd_struct *nd;
+	int val;
+
+	if (!c)
+		return count;
+	nd = (struct nd_struct *) dev_get_drvdata(c);
+	if (!nd)
+		return count;
+
+	if (sscanf(buf, "%d\n", &val) != 1 || val < 0 || val > HOLD_TIME_MAX)
+		return -EINVAL;
+
+	nd->nd_hold_time = val;
+	return count;
+}
+static DEVICE_ATTR(tx_hold_time, 0600, dgrp_node_hold_time_show, dgrp_node_hold_time_store);
+
+
+static ssize_t dgrp_node_hold_bytes_show(struct device *c, struct device_attribute *attr, char *buf)
+{
+	struct nd_struct *nd;
+
+	if (!c)
+		return 0;
+	nd = (struct nd_struct *) dev_get_drvdata(c);
+	if (!nd)
+		return 0;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", nd->nd_hold_bytes);
+}
+static ssize_t dgrp_node_hold_bytes_store(struct device *c, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct nd_struct *nd;
+	int val;
+
+	if (!c)
+		return count;
+	nd = (struct nd_struct *) dev_get_drvdata(c);
+	if (!nd)
+		return count;
+
+	if (sscanf(buf, "%d\n", &val) != 1 || val < 0 || val > UIO_MAX - UIO_BASE)
+		return -EINVAL;
+
+	nd->nd_hold_bytes = val;
+	return count;
+}
+static DEVICE_ATTR(tx_hold_bytes, 0600, dgrp_node_hold_bytes_show, dgrp_node_hold_bytes_store);
+
+
+static ssize_t dgrp_node_mon_drops_show(struct device *c, struct device_attribute *attr, char *buf)
+{
+	struct nd_struct *nd;
+
+	if (!c)
+		return 0;
+	nd = (struct nd_struct *) dev_get_drvdata(c);
+	if (!nd)
+		return 0;
+
+	return snprintf(buf, PAGE_SIZE, "%lu %lu\n",
+		nd->nd_mon_drops, nd->nd_mon_drop_bytes);
+}
+static DEVICE_ATTR(mon_drops_info, 0400, dgrp_node_mon_drops_show, NULL);
+
+
+static ssize_t dgrp_node_dpa_drops_show(struct device *c, struct device_attribute *attr, char *buf)
+{
+	struct nd_struct *nd;
+
+	if (!c)
+		return 0;
+	nd = (struct nd_struct *) dev_get_drvdata(c);
+	if (!nd)
+		return 0;
+
+	return snprintf(buf, PAGE_SIZE, "%lu %lu\n",
+		nd->nd_dpa_drops, nd->nd_dpa_drop_bytes);
+}
+static DEVICE_ATTR(dpa_drops_info, 0400, dgrp_node_dpa_drops_show, NULL);
+
+
+static ssize_t dgrp_node_latency_show(struct device *c, struct device_attribute *attr, char *buf)
+{
+	struct nd_struct *nd;
+
+	if (!c)
+		return 0;
+	nd = (struct nd_struct *) dev_get_drvdata(c);
+	if (!nd)
+		return 0;
+
+	return dgrp_lat_show(buf, nd->nd_lat);
+}
+static ssize_t dgrp_node_latency_store(struct device *c, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct nd_struct *nd;
+
+	if (!c)
+		return count;
+	nd = (struct nd_struct *) dev_get_drvdata(c);
+	if (!nd)
+		return count;
+
+	/* Any write clears the histograms */
+	memset(nd->nd_lat, 0, sizeof(nd->nd_lat));
+	return count;
+}
+static DEVICE_ATTR(latency_info, 0600, dgrp_node_latency_show, dgrp_node_latency_store);
+
+
 
 static struct attribute *dgrp_sysfs_node_entries[] = {
 	&dev_attr_state.attr,
@@ -326,6 +521,11 @@ static struct attribute *dgrp_sysfs_node_entries[] = {
 	&dev_attr_hw_version_info.attr,
 	&dev_attr_hw_id_info.attr,
 	&dev_attr_sw_version_info.attr,
+	&dev_attr_tx_hold_time.attr,
+	&dev_attr_tx_hold_bytes.attr,
+	&dev_attr_mon_drops_info.attr,
+	&dev_attr_dpa_drops_info.attr,
+	&dev_attr_latency_info.attr,
 	NULL,
 };
 
@@ -541,6 +741,215 @@ static ssize_t dgrp_tty_txcount_show(struct device *d, struct device_attribute *
 static DEVICE_ATTR(txcount_info, 0600, dgrp_tty_txcount_show, NULL);
 
 
+static ssize_t dgrp_tty_rwin_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct ch_struct *ch;
+	struct un_struct *un;
+
+	if (!d)
+		return 0;
+	un = (struct un_struct *) dev_get_drvdata(d);
+	if (!un)
+		return 0;
+	ch = un->un_ch;
+	if (!ch)
+		return 0;
+	return snprintf(buf, PAGE_SIZE, "%d %d %d\n", ch->ch_rwin_max,
+		ch->ch_s_rlow, ch->ch_s_rhigh);
+}
+static DEVICE_ATTR(rwin_info, 0400, dgrp_tty_rwin_show, NULL);
+
+
+static ssize_t dgrp_tty_rx_batch_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct ch_struct *ch;
+	struct un_struct *un;
+
+	if (!d)
+		return 0;
+	un = (struct un_struct *) dev_get_drvdata(d);
+	if (!un)
+		return 0;
+	ch = un->un_ch;
+	if (!ch)
+		return 0;
+	return snprintf(buf, PAGE_SIZE, "%s\n",
+		ch->ch_rx_batch == BATCH_ADAPTIVE ? "adaptive" : "static");
+}
+static ssize_t dgrp_tty_rx_batch_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct ch_struct *ch;
+	struct un_struct *un;
+	ulong lock_flags;
+	int mode;
+
+	if (!d)
+		return count;
+	un = (struct un_struct *) dev_get_drvdata(d);
+	if (!un)
+		return count;
+	ch = un->un_ch;
+	if (!ch)
+		return count;
+
+	if (!strncmp(buf, "adaptive", 8))
+		mode = BATCH_ADAPTIVE;
+	else if (!strncmp(buf, "static", 6))
+		mode = BATCH_STATIC;
+	else
+		return -EINVAL;
+
+	DGRP_LOCK(ch->ch_nd->nd_lock, lock_flags);
+
+	ch->ch_rx_batch = mode;
+
+	/* Put back the RMAX chosen when the port was opened */
+	if (mode == BATCH_STATIC && ch->ch_state == CS_READY) {
+		ch->ch_rmax = ch->ch_s_rsize / 4;
+		ch->ch_flag |= CH_PARAM;
+		ch->ch_nd->nd_tx_work = 1;
+	}
+
+	DGRP_UNLOCK(ch->ch_nd->nd_lock, lock_flags);
+
+	return count;
+}
+static DEVICE_ATTR(rx_batch_mode, 0600, dgrp_tty_rx_batch_show, dgrp_tty_rx_batch_store);
+
+
+static ssize_t dgrp_tty_rx_batch_info_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct ch_struct *ch;
+	struct un_struct *un;
+
+	if (!d)
+		return 0;
+	un = (struct un_struct *) dev_get_drvdata(d);
+	if (!un)
+		return 0;
+	ch = un->un_ch;
+	if (!ch)
+		return 0;
+	return snprintf(buf, PAGE_SIZE, "%d %d\n", ch->ch_s_rmax, ch->ch_s_rtime);
+}
+static DEVICE_ATTR(rx_batch_info, 0400, dgrp_tty_rx_batch_info_show, NULL);
+
+
+static ssize_t dgrp_tty_tx_batch_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct ch_struct *ch;
+	struct un_struct *un;
+
+	if (!d)
+		return 0;
+	un = (struct un_struct *) dev_get_drvdata(d);
+	if (!un)
+		return 0;
+	ch = un->un_ch;
+	if (!ch)
+		return 0;
+	return snprintf(buf, PAGE_SIZE, "%s\n",
+		ch->ch_tx_batch == BATCH_ADAPTIVE ? "adaptive" : "static");
+}
+static ssize_t dgrp_tty_tx_batch_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct ch_struct *ch;
+	struct un_struct *un;
+	ulong lock_flags;
+	int mode;
+
+	if (!d)
+		return count;
+	un = (struct un_struct *) dev_get_drvdata(d);
+	if (!un)
+		return count;
+	ch = un->un_ch;
+	if (!ch)
+		return count;
+
+	if (!strncmp(buf, "adaptive", 8))
+		mode = BATCH_ADAPTIVE;
+	else if (!strncmp(buf, "static", 6))
+		mode = BATCH_STATIC;
+	else
+		return -EINVAL;
+
+	DGRP_LOCK(ch->ch_nd->nd_lock, lock_flags);
+
+	ch->ch_tx_batch = mode;
+
+	/* Put back the TMAX/TTIME chosen when the port was opened */
+	if (mode == BATCH_STATIC && ch->ch_state == CS_READY) {
+		ch->ch_tmax = ch->ch_s_tsize / 4;
+		ch->ch_ttime = ch->ch_edelay == GLBL(ttime) ?
+			GLBL(ttime) : ch->ch_edelay;
+		ch->ch_flag |= CH_PARAM;
+		ch->ch_nd->nd_tx_work = 1;
+	}
+
+	DGRP_UNLOCK(ch->ch_nd->nd_lock, lock_flags);
+
+	return count;
+}
+static DEVICE_ATTR(tx_batch_mode, 0600, dgrp_tty_tx_batch_show, dgrp_tty_tx_batch_store);
+
+
+static ssize_t dgrp_tty_tx_batch_info_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct ch_struct *ch;
+	struct un_struct *un;
+
+	if (!d)
+		return 0;
+	un = (struct un_struct *) dev_get_drvdata(d);
+	if (!un)
+		return 0;
+	ch = un->un_ch;
+	if (!ch)
+		return 0;
+	return snprintf(buf, PAGE_SIZE, "%d %d\n", ch->ch_s_tmax, ch->ch_s_ttime);
+}
+static DEVICE_ATTR(tx_batch_info, 0400, dgrp_tty_tx_batch_info_show, NULL);
+
+
+static ssize_t dgrp_tty_latency_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct ch_struct *ch;
+	struct un_struct *un;
+
+	if (!d)
+		return 0;
+	un = (struct un_struct *) dev_get_drvdata(d);
+	if (!un)
+		return 0;
+	ch = un->un_ch;
+	if (!ch)
+		return 0;
+	return dgrp_lat_show(buf, ch->ch_lat);
+}
+static ssize_t dgrp_tty_latency_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct ch_struct *ch;
+	struct un_struct *un;
+
+	if (!d)
+		return count;
+	un = (struct un_struct *) dev_get_drvdata(d);
+	if (!un)
+		return count;
+	ch = un->un_ch;
+	if (!ch)
+		return count;
+
+	/* Any write clears the histograms */
+	memset(ch->ch_lat, 0, sizeof(ch->ch_lat));
+	return count;
+}
+/* Same file name as the node attribute, so it cannot use DEVICE_ATTR() */
+static struct device_attribute dev_attr_tty_latency_info =
+	__ATTR(latency_info, 0600, dgrp_tty_latency_show, dgrp_tty_latency_store);
+
+
 static ssize_t dgrp_tty_name_show(struct device *d, struct device_attribute *attr, char *buf)
 {
 	struct nd_struct *nd;
@@ -579,6 +988,12 @@ static struct attribute *dgrp_sysfs_tty_entries[] = {
 	&dev_attr_digi_flag_info.attr,
 	&dev_attr_rxcount_info.attr,
 	&dev_attr_txcount_info.attr,
+	&dev_attr_rwin_info.attr,
+	&dev_attr_rx_batch_mode.attr,
+	&dev_attr_rx_batch_info.attr,
+	&dev_attr_tx_batch_mode.attr,
+	&dev_attr_tx_batch_info.attr,
+	&dev_attr_tty_latency_info.attr,
 	&dev_attr_custom_name.attr,
 	NULL
 };
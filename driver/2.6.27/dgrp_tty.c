@@ -61,6 +61,7 @@
 #include <linux/serial.h>
 #include <linux/termios.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0)
 #include <linux/sched/signal.h>
 #endif
@@ -72,6 +73,8 @@
 #include "dgrp_common.h"
 #include "dgrp_tty.h"
 #include "dgrp_sysfs.h"
+#include "dgrp_genl.h"
+#include "dgrp_trace.h"
 
 #ifndef _POSIX_VDISABLE
 #define   _POSIX_VDISABLE '\0'
@@ -100,11 +103,18 @@ static int send_break(struct ch_struct *, int);
 
 static ushort  tty_to_ch_flags(struct tty_struct *, char);
 static tcflag_t ch_to_tty_flags(unsigned short, char);
+static tcflag_t drp_ocook_flags(struct ch_struct *);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,2,0)
+static int drp_termios_to_user(unsigned int, void __user *, struct ktermios *);
+#endif
+static void drp_ocook_reset(struct tty_struct *, struct ch_struct *);
 
 static void dgrp_tty_input_start(struct tty_struct *);
 static void dgrp_tty_input_stop(struct tty_struct *);
 
+static void drp_tflush(struct ch_struct *);
 static void drp_wmove(struct ch_struct *, int, void*, int);
+static void drp_tx_batch(struct ch_struct *, int);
 
 static int dgrp_tty_open(struct tty_struct *, struct file *);
 static void dgrp_tty_close(struct tty_struct *, struct file *);
@@ -112,6 +122,7 @@ static int dgrp_tty_write(struct tty_struct *, const unsigned char *, int);
 static int dgrp_tty_write_room(struct tty_struct *);
 static void dgrp_tty_flush_buffer(struct tty_struct *);
 static int dgrp_tty_chars_in_buffer(struct tty_struct *);
+static void dgrp_tty_flush_chars(struct tty_struct *);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,0,0)
 static int dgrp_tty_ioctl(struct tty_struct *, struct file *, unsigned int, unsigned long);
 #else
@@ -133,6 +144,9 @@ static int dgrp_tty_tiocmset(struct tty_struct *, unsigned int, unsigned int);
 #endif
 static int dgrp_tty_send_break(struct tty_struct *, int);
 static void dgrp_tty_send_xchar(struct tty_struct *, char);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,39)
+static int dgrp_tty_get_icount(struct tty_struct *, struct serial_icounter_struct *);
+#endif
 
 /*
  *	tty defines
@@ -141,6 +155,23 @@ static void dgrp_tty_send_xchar(struct tty_struct *, char);
 #define	SERIAL_TYPE_CALLOUT	2
 #define	SERIAL_TYPE_XPRINT	3
 
+/*
+ * Port devices are registered as the server reports its ports (see
+ * dgrp_chan_count), so on 3.7+ let the tty core set up the character
+ * device for each port then, instead of all CHAN_MAX minors when the
+ * driver is registered.  The callout driver never gets port devices,
+ * so it keeps the character devices for all its minors and links its
+ * ports up front in dgrp_tty_init().
+ */
+#define DGRP_CUDRV_FLAGS	(TTY_DRIVER_REAL_RAW | TTY_DRIVER_DYNAMIC_DEV | \
+				 TTY_DRIVER_HARDWARE_BREAK)
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
+#define DGRP_TTDRV_FLAGS	DGRP_CUDRV_FLAGS
+#else
+#define DGRP_TTDRV_FLAGS	(DGRP_CUDRV_FLAGS | TTY_DRIVER_DYNAMIC_ALLOC)
+#endif
+
 
 /*
  *	tty globals/statics
@@ -188,7 +219,7 @@ static const struct tty_operations dgrp_tty_ops = {
 	.write_room      = dgrp_tty_write_room,
 	.flush_buffer    = dgrp_tty_flush_buffer,
 	.chars_in_buffer = dgrp_tty_chars_in_buffer,
-	.flush_chars     = NULL,
+	.flush_chars     = dgrp_tty_flush_chars,
 	.ioctl           = dgrp_tty_ioctl,
 	.set_termios     = dgrp_tty_set_termios,
 	.stop            = dgrp_tty_stop,
@@ -200,11 +231,42 @@ static const struct tty_operations dgrp_tty_ops = {
 	.tiocmget        = dgrp_tty_tiocmget,
 	.tiocmset        = dgrp_tty_tiocmset,
 	.break_ctl       = dgrp_tty_send_break,
-	.send_xchar      = dgrp_tty_send_xchar
+	.send_xchar      = dgrp_tty_send_xchar,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,39)
+	.get_icount      = dgrp_tty_get_icount
+#endif
 };
 
 
 
+/*
+ * Returns non-zero if any port parameter differs from the value the
+ * server was last sent.
+ */
+static int drp_param_changed(struct ch_struct *ch)
+{
+	return ch->ch_s_brate != ch->ch_brate ||
+	       ch->ch_s_cflag != ch->ch_cflag ||
+	       ch->ch_s_iflag != ch->ch_iflag ||
+	       ch->ch_s_oflag != ch->ch_oflag ||
+	       ch->ch_s_xflag != ch->ch_xflag ||
+	       ch->ch_s_mout  != ch->ch_mout  ||
+	       ch->ch_s_mflow != ch->ch_mflow ||
+	       ch->ch_s_mctrl != ch->ch_mctrl ||
+	       ch->ch_s_xon   != ch->ch_xon   ||
+	       ch->ch_s_xoff  != ch->ch_xoff  ||
+	       ch->ch_s_lnext != ch->ch_lnext ||
+	       ch->ch_s_xxon  != ch->ch_xxon  ||
+	       ch->ch_s_xxoff != ch->ch_xxoff ||
+	       ch->ch_s_tmax  != ch->ch_tmax  ||
+	       ch->ch_s_ttime != ch->ch_ttime ||
+	       ch->ch_s_rmax  != ch->ch_rmax  ||
+	       ch->ch_s_rtime != ch->ch_rtime ||
+	       ch->ch_s_rlow  != ch->ch_rlow  ||
+	       ch->ch_s_rhigh != ch->ch_rhigh;
+}
+
+
 /*****************************************************************************
 *
 * Function:
@@ -336,15 +398,16 @@ static void drp_param(struct ch_struct *ch)
 	 */
 
 	if ((ch->ch_flag & CH_FAST_WRITE) &&
-	      O_OPOST(un->un_tty) != 0) {
+	    (O_OPOST(un->un_tty) != 0 || (ch->ch_flag & CH_OPOST))) {
 		int oflag = tty_to_ch_flags(un->un_tty, 'o');
 
 		/* add to ch_ocook any processing flags set in the termio */
 		ch->ch_ocook |= oflag & (OF_OLCUC |
 					 OF_ONLCR |
 					 OF_OCRNL |
+					 OF_ONOCR |
 					 OF_ONLRET |
-					 OF_TABDLY);
+					 OF_TAB3);
 
 		/*
 		 * the hpux driver clears any flags set in ch_ocook
@@ -355,10 +418,23 @@ static void drp_param(struct ch_struct *ch)
 		oflag = ch_to_tty_flags(ch->ch_ocook, 'o');
 		uts->c_oflag &= ~oflag;
 
+		/*
+		 * If nothing is left that the server can't do (fill
+		 * characters, NL/CR/BS/VT/FF delays, TAB1/TAB2), hide
+		 * OPOST too, so the line discipline passes writes
+		 * through without looking at each byte.  CH_OPOST
+		 * stays set only as long as this termios does; see
+		 * dgrp_tty_set_termios().
+		 */
+		if ((uts->c_oflag & ~OPOST) == 0) {
+			uts->c_oflag &= ~OPOST;
+			ch->ch_flag |= CH_OPOST;
+		}
+
 	} else {
 		/* clear the ch->ch_ocook flag */
-		int oflag = ch_to_tty_flags(ch->ch_ocook, 'o');
-		uts->c_oflag |= oflag;
+		uts->c_oflag |= drp_ocook_flags(ch);
+		ch->ch_flag &= ~CH_OPOST;
 		ch->ch_ocook = 0;
 	}
 
@@ -373,13 +449,17 @@ static void drp_param(struct ch_struct *ch)
 
 	if (C_BAUD(un->un_tty) == B0) {
 		if (!(ch->ch_flag & CH_BAUD0)) {
+			ulong ch_lock_flags;
+
 			dbg_tty_trace(IOCTL, ("dgrp_param(%x) DTR dropped!!! flushing...\n",
 				MINOR(tty_devnum(un->un_tty))));
 
 			/* TODO : the HPUX driver flushes line */
 			/* TODO : discipline, I assume I don't have to */
 
-			ch->ch_tout = ch->ch_tin;
+			DGRP_LOCK(ch->ch_lock, ch_lock_flags);
+			drp_tflush(ch);
+			DGRP_UNLOCK(ch->ch_lock, ch_lock_flags);
 			ch->ch_rout = ch->ch_rin;
 
 			ch->ch_break_time = 0;
@@ -626,11 +706,17 @@ static void drp_param(struct ch_struct *ch)
 	ch->ch_mflow = mflow;
 
 	/*
-	 *  Send the changes to the server.
+	 *  Send the changes to the server.  Nothing waits for them to
+	 *  be acknowledged; dgrp_send() sends everything that differs
+	 *  from the server's copy in one go, so changes made before it
+	 *  next runs are merged, and a call that changes nothing costs
+	 *  nothing.
 	 */
 
-	ch->ch_flag |= CH_PARAM;
-	(ch->ch_nd)->nd_tx_work = 1;
+	if (drp_param_changed(ch)) {
+		ch->ch_flag |= CH_PARAM;
+		(ch->ch_nd)->nd_tx_work = 1;
+	}
 
 	if (waitqueue_active(&ch->ch_flag_wait))
 		wake_up_interruptible(&ch->ch_flag_wait);
@@ -685,22 +771,8 @@ static int drp_wait_ack(struct ch_struct *ch, ulong *lock_flags, int ttylock)
 	 *  Forget the wait if there are no pending changes.
 	 */
 
-	if (ch->ch_send    == 0            &&
-	    ch->ch_s_brate == ch->ch_brate &&
-	    ch->ch_s_cflag == ch->ch_cflag &&
-	    ch->ch_s_iflag == ch->ch_iflag &&
-	    ch->ch_s_oflag == ch->ch_oflag &&
-	    ch->ch_s_xflag == ch->ch_xflag &&
-	    ch->ch_s_mout  == ch->ch_mout  &&
-	    ch->ch_s_mflow == ch->ch_mflow &&
-	    ch->ch_s_mctrl == ch->ch_mctrl &&
-	    ch->ch_s_xon   == ch->ch_xon   &&
-	    ch->ch_s_xoff  == ch->ch_xoff  &&
-	    ch->ch_s_lnext == ch->ch_lnext &&
-	    ch->ch_s_xxon  == ch->ch_xxon  &&
-	    ch->ch_s_xxoff == ch->ch_xxoff) {
+	if (ch->ch_send == 0 && !drp_param_changed(ch))
 		return 0;
-	}
 
 	/*
 	 *  Loop to wait one or more round trip times to the server.
@@ -781,29 +853,12 @@ if (ttylock) tty_lock(ch->port.tty);
 }
 
 
-/*
- * This function is just used as a callback for timeouts
- * waiting on the ch_sleep flag.
- */
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4,15,0)
-static void wake_up_drp_sleep_timer(unsigned long ptr)
-#else
-  static void wake_up_drp_sleep_timer(struct timer_list *ptr)
-#endif
-{
-	struct ch_struct *ch = (struct ch_struct *) ptr;
-	if (ch)
-		wake_up(&ch->ch_sleep);
-}
-
-
 /*
  * Set up our own sleep that can't be cancelled
  * until our timeout occurs.
  */
 static void drp_my_sleep(struct ch_struct *ch)
 {
-	struct timer_list drp_wakeup_timer;
 	DECLARE_WAITQUEUE(wait, current);
 
 	/*
@@ -811,27 +866,13 @@ static void drp_my_sleep(struct ch_struct *ch)
 	 */
 
 	add_wait_queue(&ch->ch_sleep, &wait);
-	current->state = TASK_UNINTERRUPTIBLE;
 
 	/*
-	 * Since we are uninterruptible, set a timer to
-	 * unset the uninterruptable state in 1 second.
+	 * Since we are uninterruptible, only sleep for 1 second.
 	 */
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4,15,0)
-	init_timer(&drp_wakeup_timer);
-	drp_wakeup_timer.function = wake_up_drp_sleep_timer;
-	drp_wakeup_timer.data = (unsigned long) ch;
-#else
-	timer_setup(&drp_wakeup_timer, wake_up_drp_sleep_timer,
-		    (unsigned long)ch);
-#endif
-	drp_wakeup_timer.expires = jiffies + (1 * HZ);
-	add_timer(&drp_wakeup_timer);
-
-	schedule();
-
-	del_timer(&drp_wakeup_timer);
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	schedule_timeout(HZ);
 
 	remove_wait_queue(&ch->ch_sleep, &wait);
 }
@@ -1365,17 +1406,9 @@ done:
 		ch->ch_open_count++;
 	}
 
-	dbg_tty_trace(OPEN, ("tty open (%x): done, ch_count(%d) un_count(%d) tty_count(%d)\n",
-			MINOR(tty_devnum(tty)), ch->ch_open_count,
-			un->un_open_count, tty->count));
-
-	if (retval) {
-		dbg_tty_trace(OPEN, ("tty open (%x) bad return\n",
-					MINOR(tty_devnum(tty))));
-	}
+	trace_dgrp_open(ch, MINOR(tty_devnum(tty)), retval);
 
-	dbg_tty_trace(OPEN, ("tty open (%x) return: %x\n",
-					MINOR(tty_devnum(tty)), retval));
+	dgrp_genl_open(ch, retval);
 
 	return retval;
 }
@@ -1454,6 +1487,13 @@ static void dgrp_tty_close(struct tty_struct *tty, struct file *file)
 	dbg_tty_trace(CLOSE, ("tty close(%x): current ch_count(%d) un_count(%d)\n",
 		MINOR(tty_devnum(tty)), ch->ch_open_count, un->un_open_count));
 
+	/*
+	 * The tty layer keeps this termios for the next open, so give
+	 * it back OPOST and the bits the server has been cooking.
+	 */
+	if (un == &ch->ch_tun && un->un_open_count == 1)
+		drp_ocook_reset(tty, ch);
+
 	DGRP_LOCK(nd->nd_lock, lock_flags);
 
 
@@ -1469,6 +1509,7 @@ static void dgrp_tty_close(struct tty_struct *tty, struct file *file)
 
 
 	un->un_flag |= UN_CLOSING;
+	wake_up_interruptible(&ch->ch_mwait);
 
 	/*
 	 * Notify the discipline to only process XON/XOFF characters.
@@ -1483,6 +1524,17 @@ static void dgrp_tty_close(struct tty_struct *tty, struct file *file)
 	 */
 
 	if (ch->ch_open_count == 1) {
+		/*
+		 * Commit anything still staged by put_char.
+		 */
+		if (ch->ch_pin != ch->ch_pout) {
+			ulong ch_lock_flags;
+
+			DGRP_LOCK(ch->ch_lock, ch_lock_flags);
+			dgrp_tty_pflush(ch);
+			DGRP_UNLOCK(ch->ch_lock, ch_lock_flags);
+		}
+
 		/*
 		 * If its the print device, we need to ensure at all costs that
 		 * the offstr will fit. If it won't, flush our tbuf.
@@ -1490,9 +1542,13 @@ static void dgrp_tty_close(struct tty_struct *tty, struct file *file)
 		if (IS_PRINT(MINOR(tty_devnum(tty))) &&
 		    (((ch->ch_tout - ch->ch_tin - 1) & TBUF_MASK) <
 		    ch->ch_digi.digi_offlen)) {
+			ulong ch_lock_flags;
+
 			dbg_tty_trace(CLOSE, ("tty close (%x) No space for offstr, resetting queue...\n",
 				MINOR(tty_devnum(tty))));
-			ch->ch_tin = ch->ch_tout;
+			DGRP_LOCK(ch->ch_lock, ch_lock_flags);
+			drp_tflush(ch);
+			DGRP_UNLOCK(ch->ch_lock, ch_lock_flags);
 		}
 
 		/*
@@ -1686,6 +1742,8 @@ static void dgrp_tty_close(struct tty_struct *tty, struct file *file)
 
 	if (!IS_PRINT(MINOR(tty_devnum(tty))))
 		ch->ch_rout = ch->ch_rin;
+	else
+		hrtimer_cancel(&ch->ch_cps_timer);
 
 
 	/*
@@ -1712,11 +1770,15 @@ static void dgrp_tty_close(struct tty_struct *tty, struct file *file)
 	 */
 
 	if (ch->ch_open_count == 1) {
+		ulong ch_lock_flags;
+
 		ch->ch_flag = 0;
 		ch->ch_category = 0;
 		ch->ch_send = 0;
 		ch->ch_expect = 0;
-		ch->ch_tout = ch->ch_tin;
+		DGRP_LOCK(ch->ch_lock, ch_lock_flags);
+		drp_tflush(ch);
+		DGRP_UNLOCK(ch->ch_lock, ch_lock_flags);
 		/* (un->un_tty)->device = 0; */
 
 		if (ch->ch_state == CS_READY)
@@ -1758,17 +1820,30 @@ unlock:
 
 	DGRP_UNLOCK(nd->nd_lock, lock_flags);
 
-	dbg_tty_trace(CLOSE, ("tty close (%x): done, ch_count(%d) un_count(%d) tty_count(%d)\n",
-		MINOR(tty_devnum(tty)), ch->ch_open_count,
-		un->un_open_count, tty->count));
+	trace_dgrp_close(ch, MINOR(tty_devnum(tty)));
 
-	dbg_tty_trace(CLOSE, ("tty close (%x) return\n",
-		MINOR(tty_devnum(tty))));
+	dgrp_genl_close(ch);
 
 	return;
 
 }
 
+/*
+ *  Discard the unsent transmit data.  Called with ch_lock held.  While
+ *  dgrp_send() still has ch_tbuf pieces waiting to be copied to the
+ *  daemon, ch_tout belongs to dgrp_net_copyout(); just remember where
+ *  it should end up and let the copyout apply it.
+ */
+static void drp_tflush(struct ch_struct *ch)
+{
+	if (ch->ch_txvec) {
+		ch->ch_tflush = ch->ch_tin;
+		ch->ch_tflushed = 1;
+	} else {
+		ch->ch_tout = ch->ch_tin;
+	}
+}
+
 static void drp_wmove(struct ch_struct *ch, int from_user, void *buf, int count)
 {
 	int n;
@@ -1776,6 +1851,9 @@ static void drp_wmove(struct ch_struct *ch, int from_user, void *buf, int count)
 
 	ch->ch_nd->nd_tx_work = 1;
 
+	if (GLBL(latency) && (!ch->ch_lat_tx || ch->ch_tin == ch->ch_tout))
+		ch->ch_lat_tx = dgrp_lat_now();
+
 	n = TBUF_MAX - ch->ch_tin;
 
 	if (count >= n) {
@@ -1786,6 +1864,7 @@ static void drp_wmove(struct ch_struct *ch, int from_user, void *buf, int count)
 
 		buf = (char *) buf + n;
 		count -= n;
+		smp_wmb();
 		ch->ch_tin = 0;
 	}
 
@@ -1794,14 +1873,225 @@ static void drp_wmove(struct ch_struct *ch, int from_user, void *buf, int count)
 	else
 		memcpy(ch->ch_tbuf + ch->ch_tin, buf, count);
 
+	smp_wmb();
 	ch->ch_tin += count;
 }
 
 
+/*
+ *	Commit characters staged by dgrp_tty_put_char() to the
+ *	transmit buffer, with the same accounting dgrp_tty_write() does.
+ *	Called with ch_lock held, from the tty side and from dgrp_send().
+ *
+ *	The staging buffer has a single producer (put_char, which the
+ *	line discipline serializes) and a single consumer (us, under
+ *	ch_lock), so the producer side needs no lock at all.
+ */
+void dgrp_tty_pflush(struct ch_struct *ch)
+{
+	struct nd_struct *nd = ch->ch_nd;
+	int n;
+	int t;
+	int count;
+	int space;
+	ushort tin;
+	uchar pout;
+
+	n = (ch->ch_pin - ch->ch_pout) & PBUF_MASK;
+	if (n == 0)
+		return;
+
+	smp_rmb();
+
+	space = (ch->ch_tout - ch->ch_tin - 1) & TBUF_MASK;
+	if (n > space)
+		n = space;
+	if (n == 0)
+		return;
+
+	count = n;
+	tin = ch->ch_tin;
+	pout = ch->ch_pout;
+
+	if (GLBL(latency) && (!ch->ch_lat_tx || tin == ch->ch_tout))
+		ch->ch_lat_tx = dgrp_lat_now();
+
+	if (DGRP_DPA_TRACED(nd, ch->ch_portnum)) {
+		t = min(count, PBUF_MAX - pout);
+		dgrp_dpa_data(nd, ch->ch_portnum, 0,
+			      (char *) ch->ch_pbuf + pout, t);
+		if (count > t)
+			dgrp_dpa_data(nd, ch->ch_portnum, 0,
+				      (char *) ch->ch_pbuf, count - t);
+	}
+
+	while (n-- > 0) {
+		ch->ch_tbuf[tin] = ch->ch_pbuf[pout];
+		tin = (tin + 1) & TBUF_MASK;
+		pout = (pout + 1) & PBUF_MASK;
+	}
+
+	smp_wmb();
+	ch->ch_tin = tin;
+	ch->ch_pout = pout;
+
+	ch->ch_txcount += count;
+
+	if (ch->ch_tx_batch == BATCH_ADAPTIVE &&
+	    ch->ch_edelay == GLBL(ttime))
+		drp_tx_batch(ch, count);
+
+	nd->nd_tx_work = 1;
+}
+
+
+/*
+ *	Adaptive transmit batching.  Called with ch_lock held and the
+ *	number of bytes each write queued on a channel in BATCH_ADAPTIVE
+ *	mode.
+ *
+ *	TMAX/TTIME tell the server how much data it may drain, or how
+ *	long it may wait, before reporting transmit progress back to us.
+ *	Short writes into an idle queue are interactive: report early
+ *	so echo and write_room() stay quick.  Large writes, or a queue
+ *	that stays more than half full, are bulk output: let the server
+ *	drain up to half its buffer before each report, which saves
+ *	round trips without letting the buffer run dry.
+ */
+static void drp_tx_batch(struct ch_struct *ch, int count)
+{
+	long avg;
+	long queued;
+	ushort tmax;
+	ushort ttime;
+
+	ch->ch_tx_avg += count - ch->ch_tx_avg / 8;
+
+	avg = ch->ch_tx_avg / 8;
+
+	queued = ((ch->ch_tin - ch->ch_tout) & TBUF_MASK) +
+		 ((ch->ch_s_tin - ch->ch_s_tpos) & 0xffff);
+
+	tmax  = ch->ch_s_tsize / 4;
+	ttime = GLBL(ttime);
+
+	if (avg <= 8 && queued < ch->ch_s_tsize / 4) {
+		tmax  = ch->ch_s_tsize / 8;
+		ttime = 10;
+	} else if (avg >= 256 || queued >= ch->ch_s_tsize / 2) {
+		tmax  = ch->ch_s_tsize / 2;
+	}
+
+	/*
+	 * ch_tmax, ch_ttime and ch_flag belong to nd_lock, which cannot
+	 * be taken inside ch_lock; dgrp_send() applies the change.
+	 */
+	ch->ch_tx_tmax  = tmax;
+	ch->ch_tx_ttime = ttime;
+}
+
+
+/*
+ * We measure printer CPS speed by advancing ch_cpstime by
+ * (NSEC_PER_SEC / digi_maxcps) for every character we output,
+ * restricting output so that ch_cpstime never passes the current
+ * time.
+ *
+ * However if output has not been done for some time, the clock
+ * will be very much later than ch_cpstime, which would allow
+ * essentially unlimited amounts of output until ch_cpstime finally
+ * caught up.   To avoid this, we adjust ch_cpstime when necessary
+ * so the difference never results in sending more than digi_bufsize
+ * characters.
+ *
+ * This nicely models a printer with an internal buffer of
+ * digi_bufsize characters.
+ *
+ * Returns the number of characters that can be sent now without
+ * violating the time constraint.
+ */
+static int drp_cps_room(struct ch_struct *ch)
+{
+	ktime_t now = ktime_get();
+	s64 tt;
+	s64 mt;
+
+	/*
+	 * Get the time between now and ch->ch_cpstime, and the
+	 * time required to send digi_bufsize characters.
+	 */
+	tt = ktime_to_ns(ktime_sub(now, ch->ch_cpstime));
+	mt = div_u64((u64) NSEC_PER_SEC * ch->ch_digi.digi_bufsize,
+		     ch->ch_digi.digi_maxcps);
+
+	if (tt <= 0)
+		return 0;
+
+	if (tt > mt) {
+		ch->ch_cpstime = ktime_sub_ns(now, mt);
+		return ch->ch_digi.digi_bufsize;
+	}
+
+	return div_u64((u64) ch->ch_digi.digi_maxcps * tt, NSEC_PER_SEC);
+}
+
+
+/*
+ * Adjust ch_cpstime to account for count characters just output,
+ * and work out when we'll be able to send a block of digi_maxchar
+ * characters.
+ */
+static void drp_cps_charge(struct ch_struct *ch, int count)
+{
+	u64 cc = (u64) NSEC_PER_SEC * count + ch->ch_cpsrem;
+	u32 rem;
+
+	ch->ch_cpstime = ktime_add_ns(ch->ch_cpstime,
+			div_u64_rem(cc, ch->ch_digi.digi_maxcps, &rem));
+	ch->ch_cpsrem = rem;
+
+	ch->ch_waketime = ktime_add_ns(ch->ch_cpstime,
+			div_u64((u64) NSEC_PER_SEC * ch->ch_digi.digi_maxchar,
+				ch->ch_digi.digi_maxcps));
+}
+
+
+/*
+ * The printer unit is waiting on time.  Have ch_cps_timer wake its
+ * writers at ch_waketime rather than waiting for the poller to
+ * notice.
+ */
+static void drp_cps_arm(struct ch_struct *ch)
+{
+	hrtimer_start(&ch->ch_cps_timer, ch->ch_waketime, HRTIMER_MODE_ABS);
+}
+
+
+static enum hrtimer_restart drp_cps_wakeup(struct hrtimer *timer)
+{
+	struct ch_struct *ch = container_of(timer, struct ch_struct,
+					    ch_cps_timer);
+	struct tty_struct *tty;
+	ulong lock_flags;
+
+	DGRP_LOCK(ch->ch_lock, lock_flags);
+
+	tty = ch->ch_pun.un_tty;
+
+	if (ch->ch_pun.un_open_count && tty &&
+	    (ch->ch_pun.un_flag & UN_TIME) != 0) {
+		ch->ch_pun.un_flag &= ~UN_TIME;
+		wake_up_interruptible(&tty->write_wait);
+	}
+
+	DGRP_UNLOCK(ch->ch_lock, lock_flags);
+
+	return HRTIMER_NORESTART;
+}
+
+
 static int dgrp_calculate_txprint_bounds(struct ch_struct *ch, int space, int *un_flag)
 {
-	clock_t tt;
-	clock_t mt;
 	unsigned short tmax = 0;
 
 	/*
@@ -1828,49 +2118,9 @@ static int dgrp_calculate_txprint_bounds(struct ch_struct *ch, int space, int *u
 	}
 
 	/*
-	 * We measure printer CPS speed by incrementing
-	 * ch_cpstime by (HZ / digi_maxcps) for every
-	 * character we output, restricting output so
-	 * that ch_cpstime never exceeds lbolt.
-	 *
-	 * However if output has not been done for some
-	 * time, lbolt will grow to very much larger than
-	 * ch_cpstime, which would allow essentially
-	 * unlimited amounts of output until ch_cpstime
-	 * finally caught up.   To avoid this, we adjust
-	 * cps_time when necessary so the difference
-	 * between lbolt and ch_cpstime never results
-	 * in sending more than digi_bufsize characters.
-	 *
-	 * This nicely models a printer with an internal
-	 * buffer of digi_bufsize characters.
-	 *
-	 * Get the time between lbolt and ch->ch_cpstime;
+	 * Number of characters the CPS limit lets us send now.
 	 */
-
-	tt = jiffies - ch->ch_cpstime;
-
-	/*
-	 * Compute the time required to send digi_bufsize
-	 * characters.
-	 */
-
-	mt = HZ * ch->ch_digi.digi_bufsize / ch->ch_digi.digi_maxcps;
-
-	/*
-	 * Compute the number of characters that can be sent
-	 * without violating the time constraint.   If the
-	 * direct calculation of this number is bigger than
-	 * digi_bufsize, limit the number to digi_bufsize,
-	 * and adjust cpstime to match.
-	 */
-
-	if ((clock_t)(tt + HZ) > (clock_t)(mt + HZ)) {
-		tmax = ch->ch_digi.digi_bufsize;
-		ch->ch_cpstime = jiffies - mt;
-	} else {
-		tmax = ch->ch_digi.digi_maxcps * tt / HZ;
-	}
+	tmax = drp_cps_room(ch);
 
 	/*
 	 * If the time constraint now binds, limit the transmit
@@ -1950,13 +2200,18 @@ static int dgrp_tty_write(struct tty_struct *tty, const unsigned char *buf, int
 		   MINOR(tty_devnum(tty)), (long) tty, from_user, count));
 
 
-	DGRP_LOCK(GLBL(poll_lock), lock_flags);
+	DGRP_LOCK(ch->ch_lock, lock_flags);
+
+	/*
+	 * Anything put_char staged goes ahead of this write.
+	 */
+	dgrp_tty_pflush(ch);
 
 	/*
 	 * Ignore the request if output is blocked.
 	 */
 	if ((un->un_flag & (UN_EMPTY | UN_LOW | UN_TIME | UN_PWAIT)) != 0) {
-		DGRP_UNLOCK(GLBL(poll_lock), lock_flags);
+		DGRP_UNLOCK(ch->ch_lock, lock_flags);
 		dbg_tty_trace(WRITE, ("dgrp_tty_write(%x) - wrote 0\n",
 			   MINOR(tty_devnum(tty))));
 		return 0;
@@ -1966,9 +2221,9 @@ static int dgrp_tty_write(struct tty_struct *tty, const unsigned char *buf, int
 	 * Also ignore the request if DPA has this port open,
 	 * and is flow controlled on reading more data.
 	 */
-	if (nd->nd_dpa_debug && nd->nd_dpa_flag & DPA_WAIT_SPACE &&
-		nd->nd_dpa_port == MINOR(tty_devnum(ch->ch_tun.un_tty))) {
-		DGRP_UNLOCK(GLBL(poll_lock), lock_flags);
+	if (nd->nd_dpa_flag & DPA_WAIT_SPACE &&
+	    DGRP_DPA_TRACED(nd, ch->ch_portnum)) {
+		DGRP_UNLOCK(ch->ch_lock, lock_flags);
 		return 0;
 	}
 
@@ -1987,8 +2242,6 @@ static int dgrp_tty_write(struct tty_struct *tty, const unsigned char *buf, int
 	un_flag = UN_LOW;
 
 	if (IS_PRINT(MINOR(tty_devnum(tty)))) {
-		clock_t tt;
-		clock_t mt;
 		unsigned short tmax = 0;
 
 		/*
@@ -1999,7 +2252,7 @@ static int dgrp_tty_write(struct tty_struct *tty, const unsigned char *buf, int
 		if (ch->ch_tun.un_open_count != 0 &&
 		    ((ch->ch_tun.un_tty->ops->chars_in_buffer)(ch->ch_tun.un_tty) != 0)) {
 			un->un_flag |= UN_PWAIT;
-			DGRP_UNLOCK(GLBL(poll_lock), lock_flags);
+			DGRP_UNLOCK(ch->ch_lock, lock_flags);
 			dbg_tty_trace(WRITE, ("dgrp_tty_write(%x) - wrote 0\n",
 				   MINOR(tty_devnum(tty))));
 			return 0;
@@ -2022,7 +2275,7 @@ static int dgrp_tty_write(struct tty_struct *tty, const unsigned char *buf, int
 			if (space < 0) {
 				un->un_flag |= UN_EMPTY;
 				(ch->ch_nd)->nd_tx_work = 1;
-				DGRP_UNLOCK(GLBL(poll_lock), lock_flags);
+				DGRP_UNLOCK(ch->ch_lock, lock_flags);
 				dbg_tty_trace(WRITE, ("dgrp_tty_write(%x) - wrote 0\n",
 					   MINOR(tty_devnum(tty))));
 				return 0;
@@ -2035,49 +2288,9 @@ static int dgrp_tty_write(struct tty_struct *tty, const unsigned char *buf, int
 		}
 
 		/*
-		 * We measure printer CPS speed by incrementing
-		 * ch_cpstime by (HZ / digi_maxcps) for every
-		 * character we output, restricting output so
-		 * that ch_cpstime never exceeds lbolt.
-		 *
-		 * However if output has not been done for some
-		 * time, lbolt will grow to very much larger than
-		 * ch_cpstime, which would allow essentially
-		 * unlimited amounts of output until ch_cpstime
-		 * finally caught up.   To avoid this, we adjust
-		 * cps_time when necessary so the difference
-		 * between lbolt and ch_cpstime never results
-		 * in sending more than digi_bufsize characters.
-		 *
-		 * This nicely models a printer with an internal
-		 * buffer of digi_bufsize characters.
-		 *
-		 * Get the time between lbolt and ch->ch_cpstime;
+		 * Number of characters the CPS limit lets us send now.
 		 */
-
-		tt = jiffies - ch->ch_cpstime;
-
-		/*
-		 * Compute the time required to send digi_bufsize
-		 * characters.
-		 */
-
-		mt = HZ * ch->ch_digi.digi_bufsize / ch->ch_digi.digi_maxcps;
-
-		/*
-		 * Compute the number of characters that can be sent
-		 * without violating the time constraint.   If the
-		 * direct calculation of this number is bigger than
-		 * digi_bufsize, limit the number to digi_bufsize,
-		 * and adjust cpstime to match.
-		 */
-
-		if ((clock_t)(tt + HZ) > (clock_t)(mt + HZ)) {
-			tmax = ch->ch_digi.digi_bufsize;
-			ch->ch_cpstime = jiffies - mt;
-		} else {
-			tmax = ch->ch_digi.digi_maxcps * tt / HZ;
-		}
+		tmax = drp_cps_room(ch);
 
 		/*
 		 * If the time constraint now binds, limit the transmit
@@ -2147,9 +2360,18 @@ static int dgrp_tty_write(struct tty_struct *tty, const unsigned char *buf, int
 		/* the linux tty_io.c handles this if we return 0 */
 		/* if (fp->flags & O_NONBLOCK) return -EAGAIN; */
 
-		un->un_flag |= UN_EMPTY;
+		/*
+		 * If it is the CPS limit that binds, ch_cps_timer
+		 * restarts us when the next block may be sent.
+		 */
+		if ((un_flag & UN_TIME) != 0) {
+			un->un_flag |= UN_TIME;
+			drp_cps_arm(ch);
+		} else {
+			un->un_flag |= UN_EMPTY;
+		}
 		(ch->ch_nd)->nd_tx_work = 1;
-		DGRP_UNLOCK(GLBL(poll_lock), lock_flags);
+		DGRP_UNLOCK(ch->ch_lock, lock_flags);
 		dbg_tty_trace(WRITE, ("dgrp_tty_write(%x) - wrote 0\n",
 			      MINOR(tty_devnum(tty))));
 		return 0;
@@ -2170,7 +2392,7 @@ static int dgrp_tty_write(struct tty_struct *tty, const unsigned char *buf, int
 		 * We must drop lock, because we will be
 		 * going out to user space...
 		 */
-		DGRP_UNLOCK(GLBL(poll_lock), lock_flags);
+		DGRP_UNLOCK(ch->ch_lock, lock_flags);
 
 		/*
 		 * Grab the writebuf semaphore.
@@ -2200,7 +2422,13 @@ static int dgrp_tty_write(struct tty_struct *tty, const unsigned char *buf, int
 		}
 
 		/* Reobtain lock... */
-		DGRP_LOCK(GLBL(poll_lock), lock_flags);
+		DGRP_LOCK(ch->ch_lock, lock_flags);
+
+		/*
+		 * dgrp_send() may have drained put_char staging into
+		 * ch_tbuf meanwhile; queue only what still fits.
+		 */
+		count = min(count, (ch->ch_tout - ch->ch_tin - 1) & TBUF_MASK);
 
 		/* Point buf pointer to our internal write buffer */
 		buf = nd->nd_writebuf;
@@ -2221,24 +2449,35 @@ static int dgrp_tty_write(struct tty_struct *tty, const unsigned char *buf, int
 
 		if (n >= t) {
 			memcpy(ch->ch_tbuf + ch->ch_tin, buf, t);
-			if (nd->nd_dpa_debug && nd->nd_dpa_port == PORT_NUM(MINOR(tty_devnum(un->un_tty))))
-				dgrp_dpa_data(nd, 0, (char *) buf, t);
+			if (DGRP_DPA_TRACED(nd, ch->ch_portnum))
+				dgrp_dpa_data(nd, ch->ch_portnum, 0, (char *) buf, t);
 			buf += t;
 			n -= t;
+			smp_wmb();
 			ch->ch_tin = 0;
 			sendcount += n;
 		}
 
 		memcpy(ch->ch_tbuf + ch->ch_tin, buf, n);
-		if (nd->nd_dpa_debug && nd->nd_dpa_port == PORT_NUM(MINOR(tty_devnum(un->un_tty))))
-			dgrp_dpa_data(nd, 0, (char *) buf, n);
+		if (DGRP_DPA_TRACED(nd, ch->ch_portnum))
+			dgrp_dpa_data(nd, ch->ch_portnum, 0, (char *) buf, n);
 		buf += n;
+		smp_wmb();
 		ch->ch_tin += n;
 		sendcount += n;
 
+		if (ch->ch_tx_batch == BATCH_ADAPTIVE &&
+		    ch->ch_edelay == GLBL(ttime))
+			drp_tx_batch(ch, count);
+
 		un->un_tbusy--;
 		(ch->ch_nd)->nd_tx_work = 1;
-		if (ch->ch_edelay != GLBL(rtime)) {
+
+		/*
+		 * Leave the wakeup to the poller if the node is
+		 * coalescing output from several ports.
+		 */
+		if (ch->ch_edelay != GLBL(rtime) && nd->nd_hold_time <= 0) {
 			(ch->ch_nd)->nd_tx_ready = 1;
 			wake_up_interruptible(&nd->nd_tx_waitq);
 		}
@@ -2253,24 +2492,8 @@ static int dgrp_tty_write(struct tty_struct *tty, const unsigned char *buf, int
 		 * for the characters just output.
 		 */
 
-		if (sendcount > 0) {
-			int cc = HZ * sendcount + ch->ch_cpsrem;
-
-			ch->ch_cpstime += cc / ch->ch_digi.digi_maxcps;
-			ch->ch_cpsrem   = cc % ch->ch_digi.digi_maxcps;
-		}
-
-		/*
-		 * If we are now waiting on time, schedule ourself
-		 * back when we'll be able to send a block of
-		 * digi_maxchar characters.
-		 */
-
-		if ((un_flag & UN_TIME) != 0) {
-			ch->ch_waketime = (ch->ch_cpstime +
-				(ch->ch_digi.digi_maxchar * HZ /
-				ch->ch_digi.digi_maxcps));
-		}
+		if (sendcount > 0)
+			drp_cps_charge(ch, sendcount);
 	}
 
 	/*
@@ -2283,10 +2506,10 @@ static int dgrp_tty_write(struct tty_struct *tty, const unsigned char *buf, int
 
 	/* Let go of any locks/semaphores we might have held... */
 	if (from_user) {
-		DGRP_UNLOCK(GLBL(poll_lock), lock_flags);
+		DGRP_UNLOCK(ch->ch_lock, lock_flags);
 		up(&nd->nd_writebuf_semaphore);
 	} else {
-		DGRP_UNLOCK(GLBL(poll_lock), lock_flags);
+		DGRP_UNLOCK(ch->ch_lock, lock_flags);
 	}
 
 	dbg_tty_trace(WRITE, ("dgrp_tty_write(%x) - wrote %d\n",
@@ -2325,7 +2548,38 @@ static int dgrp_tty_put_char(struct tty_struct *tty, unsigned char new_char)
 	dbg_tty_trace(WRITE, ("dgrp_tty_put_char(%x): tty=%lx char(%x)\n",
 		   MINOR(tty_devnum(tty)), (long)tty, new_char));
 
-	DGRP_LOCK(GLBL(poll_lock), lock_flags);
+	/*
+	 * Terminal output is only staged here.  dgrp_tty_flush_chars()
+	 * commits the whole burst to ch_tbuf under a single lock, and
+	 * dgrp_send() picks up anything a caller left without flushing.
+	 * Printer output keeps going straight to ch_tbuf, since every
+	 * character counts against the CPS limit.
+	 */
+	if (!IS_PRINT(MINOR(tty_devnum(tty))) && (ch->ch_flag & CH_PRON) == 0) {
+		if (((ch->ch_pin - ch->ch_pout) & PBUF_MASK) == PBUF_MASK) {
+			DGRP_LOCK(ch->ch_lock, lock_flags);
+			dgrp_tty_pflush(ch);
+			DGRP_UNLOCK(ch->ch_lock, lock_flags);
+
+			if (((ch->ch_pin - ch->ch_pout) & PBUF_MASK) == PBUF_MASK) {
+				dbg_tty_trace(WRITE, ("dgrp_tty_put_char(%x): Space == 0 in"
+					" tbuf, dropping character\n", MINOR(tty_devnum(tty))));
+				return 0;
+			}
+		}
+
+		ch->ch_pbuf[ch->ch_pin] = new_char;
+		smp_wmb();
+		ch->ch_pin = (ch->ch_pin + 1) & PBUF_MASK;
+
+		(ch->ch_nd)->nd_tx_work = 1;
+
+		return 1;
+	}
+
+	DGRP_LOCK(ch->ch_lock, lock_flags);
+
+	dgrp_tty_pflush(ch);
 
 
 	/*
@@ -2348,7 +2602,7 @@ static int dgrp_tty_put_char(struct tty_struct *tty, unsigned char new_char)
 				MINOR(tty_devnum(tty)), space));
 
 			un->un_tbusy--;
-			DGRP_UNLOCK(GLBL(poll_lock), lock_flags);
+			DGRP_UNLOCK(ch->ch_lock, lock_flags);
 			return 0;
 		}
 		space -= ch->ch_digi.digi_onlen;
@@ -2368,7 +2622,7 @@ static int dgrp_tty_put_char(struct tty_struct *tty, unsigned char new_char)
 			MINOR(tty_devnum(tty)), space));
 
 			un->un_tbusy--;
-			DGRP_UNLOCK(GLBL(poll_lock), lock_flags);
+			DGRP_UNLOCK(ch->ch_lock, lock_flags);
 			return 0;
 		}
 		space -= ch->ch_digi.digi_offlen;
@@ -2381,7 +2635,7 @@ static int dgrp_tty_put_char(struct tty_struct *tty, unsigned char new_char)
 		dbg_tty_trace(WRITE, ("dgrp_tty_put_char(%x): Space == 0 in"
 			" tbuf, dropping character\n", MINOR(tty_devnum(tty))));
 		un->un_tbusy--;
-		DGRP_UNLOCK(GLBL(poll_lock), lock_flags);
+		DGRP_UNLOCK(ch->ch_lock, lock_flags);
 		return 0;
 	}
 
@@ -2390,6 +2644,7 @@ static int dgrp_tty_put_char(struct tty_struct *tty, unsigned char new_char)
 	 * 	careful to wrap around the circular queue
 	 */
 	ch->ch_tbuf[ch->ch_tin] = new_char;
+	smp_wmb();
 	ch->ch_tin = (1 + ch->ch_tin) & TBUF_MASK;
 
 
@@ -2400,33 +2655,59 @@ static int dgrp_tty_put_char(struct tty_struct *tty, unsigned char new_char)
 		 * for the character just output.
 		 */
 
-		int cc = HZ + ch->ch_cpsrem;
-
-		ch->ch_cpstime += cc / ch->ch_digi.digi_maxcps;
-		ch->ch_cpsrem   = cc % ch->ch_digi.digi_maxcps;
-
-		/*
-		 * If we are now waiting on time, schedule ourself
-		 * back when we'll be able to send a block of
-		 * digi_maxchar characters.
-		 */
-
-		ch->ch_waketime = (ch->ch_cpstime +
-			(ch->ch_digi.digi_maxchar * HZ /
-			ch->ch_digi.digi_maxcps));
+		drp_cps_charge(ch, 1);
 	}
 
 
 	un->un_tbusy--;
 	(ch->ch_nd)->nd_tx_work = 1;
 
-	DGRP_UNLOCK(GLBL(poll_lock), lock_flags);
+	DGRP_UNLOCK(ch->ch_lock, lock_flags);
 
 	return 1;
 }
 
 
 
+/*
+ *	Commit the characters staged by dgrp_tty_put_char().
+ *
+ *	- called by the line discipline after a burst of put_char calls
+ */
+static void dgrp_tty_flush_chars(struct tty_struct *tty)
+{
+	struct un_struct *un;
+	struct ch_struct *ch;
+	struct nd_struct *nd;
+	ulong lock_flags;
+
+	if (!tty)
+		return;
+
+	un = tty->driver_data;
+	if (!un)
+		return;
+
+	ch = un->un_ch;
+	if (!ch)
+		return;
+
+	nd = ch->ch_nd;
+
+	if (ch->ch_pin == ch->ch_pout)
+		return;
+
+	DGRP_LOCK(ch->ch_lock, lock_flags);
+	dgrp_tty_pflush(ch);
+	DGRP_UNLOCK(ch->ch_lock, lock_flags);
+
+	if (ch->ch_edelay != GLBL(rtime) && nd->nd_hold_time <= 0) {
+		nd->nd_tx_ready = 1;
+		wake_up_interruptible(&nd->nd_tx_waitq);
+	}
+}
+
+
 /*
  *	Flush TX buffer (make in == out)
  *
@@ -2436,6 +2717,7 @@ static void dgrp_tty_flush_buffer(struct tty_struct *tty)
 {
 	struct un_struct *un;
 	struct ch_struct *ch;
+	ulong lock_flags;
 
 	if (!tty)
 		return;
@@ -2450,7 +2732,10 @@ static void dgrp_tty_flush_buffer(struct tty_struct *tty)
 	dbg_tty_trace(WRITE, ("dgrp_tty_flush_buffer(%x) start\n",
 		      MINOR(tty_devnum(tty))));
 
-	ch->ch_tout = ch->ch_tin;
+	DGRP_LOCK(ch->ch_lock, lock_flags);
+	ch->ch_pout = ch->ch_pin;
+	drp_tflush(ch);
+	DGRP_UNLOCK(ch->ch_lock, lock_flags);
 	/* do NOT do this here! */
 	/* ch->ch_s_tpos = ch->ch_s_tin = 0; */
 
@@ -2492,6 +2777,11 @@ static int dgrp_tty_write_room(struct tty_struct *tty)
 
 	count = (ch->ch_tout - ch->ch_tin - 1) & TBUF_MASK;
 
+	/* Leave room for anything put_char has staged */
+	count -= (ch->ch_pin - ch->ch_pout) & PBUF_MASK;
+	if (count < 0)
+		count = 0;
+
 	/* We *MUST* check this, and return 0 if the Printer Unit cannot
 	 * take any more data within its time constraints...  If we don't
 	 * return 0 and the printer has hit it time constraint, the ld will
@@ -2505,6 +2795,9 @@ static int dgrp_tty_write_room(struct tty_struct *tty)
 
 		ch->ch_pun.un_flag |= un_flag;
 		(ch->ch_nd)->nd_tx_work = 1;
+
+		if ((un_flag & UN_TIME) != 0)
+			drp_cps_arm(ch);
 	}
 
 	dbg_tty_trace(WRITE, ("dgrp_tty_write_room(%x) count(%d) busy(%d)\n",
@@ -2542,6 +2835,7 @@ static int dgrp_tty_chars_in_buffer(struct tty_struct *tty)
 		return 0;
 
 	count1 = count = (ch->ch_tin - ch->ch_tout) & TBUF_MASK;
+	count += (ch->ch_pin - ch->ch_pout) & PBUF_MASK;
 	count += (ch->ch_s_tin - ch->ch_s_tpos) & 0xffff;
 	/* one for tbuf, one for the PS */
 
@@ -2645,8 +2939,7 @@ static tcflag_t ch_to_tty_flags(ushort ch_flag, char flagtype)
 		     | ((ch_flag & OF_OCRNL) ? OCRNL  : 0)
 		     | ((ch_flag & OF_ONOCR) ? ONOCR  : 0)
 		     | ((ch_flag & OF_ONLRET) ? ONLRET : 0)
-		  /* | ((ch_flag & OF_OTAB3) ? OFILL  : 0) */
-		     | ((ch_flag & OF_TABDLY) ? TABDLY : 0);
+		     | ((ch_flag & OF_TAB3) == OF_TAB3 ? TAB3 : 0);
 		break;
 
 	case 'c':
@@ -2763,8 +3056,7 @@ static ushort tty_to_ch_flags(struct tty_struct *tty, char flagtype)
 			     | (O_OCRNL(tty)  ? OF_OCRNL  : 0)
 			     | (O_ONOCR(tty)  ? OF_ONOCR  : 0)
 			     | (O_ONLRET(tty) ? OF_ONLRET : 0)
-			  /* | (O_OFILL(tty)  ? OF_TAB3   : 0) */
-			     | (O_TABDLY(tty) ? OF_TABDLY : 0);
+			     | (O_TABDLY(tty) == TAB3 ? OF_TAB3 : 0);
 		break;
 	case 'c':
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
@@ -2812,6 +3104,109 @@ static ushort tty_to_ch_flags(struct tty_struct *tty, char flagtype)
 }
 
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,2,0)
+/*
+ * From 6.2 the kernel_termios_to_user_*() helpers are out of line and
+ * not exported to modules, so fill in the user's termio, termios or
+ * termios2 for TCGETA, TCGETS or TCGETS2 here.
+ */
+static int drp_termios_to_user(unsigned int cmd, void __user *arg,
+			       struct ktermios *kterm)
+{
+	if (cmd == TCGETA) {
+		struct termio v;
+
+		memset(&v, 0, sizeof(v));
+		v.c_iflag = kterm->c_iflag;
+		v.c_oflag = kterm->c_oflag;
+		v.c_cflag = kterm->c_cflag;
+		v.c_lflag = kterm->c_lflag;
+		v.c_line  = kterm->c_line;
+		memcpy(v.c_cc, kterm->c_cc, NCC);
+		return copy_to_user(arg, &v, sizeof(v));
+	}
+
+	if (cmd == TCGETS2) {
+		struct termios2 v;
+
+		memset(&v, 0, sizeof(v));
+		v.c_iflag  = kterm->c_iflag;
+		v.c_oflag  = kterm->c_oflag;
+		v.c_cflag  = kterm->c_cflag;
+		v.c_lflag  = kterm->c_lflag;
+		v.c_line   = kterm->c_line;
+		memcpy(v.c_cc, kterm->c_cc, NCCS);
+		v.c_ispeed = kterm->c_ispeed;
+		v.c_ospeed = kterm->c_ospeed;
+		return copy_to_user(arg, &v, sizeof(v));
+	}
+
+	{
+		struct termios v;
+
+		memset(&v, 0, sizeof(v));
+		v.c_iflag = kterm->c_iflag;
+		v.c_oflag = kterm->c_oflag;
+		v.c_cflag = kterm->c_cflag;
+		v.c_lflag = kterm->c_lflag;
+		v.c_line  = kterm->c_line;
+		memcpy(v.c_cc, kterm->c_cc, NCCS);
+		return copy_to_user(arg, &v, sizeof(v));
+	}
+}
+#endif
+
+
+/*
+ * Return the termios oflag bits the server is cooking for us, which
+ * drp_param() removed from the tty's termios.
+ */
+static tcflag_t drp_ocook_flags(struct ch_struct *ch)
+{
+	tcflag_t oflag = ch_to_tty_flags(ch->ch_ocook, 'o');
+
+	if (ch->ch_flag & CH_OPOST)
+		oflag |= OPOST;
+
+	return oflag;
+}
+
+
+/*
+ * A TCSETS* replaces the whole termios with the user's view of it.
+ * Hand the oflags cooked by the server back to the tty first, so the
+ * old termios the tty layer compares against is what the user saw,
+ * and let drp_param() work out the offload from scratch.
+ */
+static void drp_ocook_reset(struct tty_struct *tty, struct ch_struct *ch)
+{
+	ulong lock_flags;
+
+	if (!ch->ch_ocook && !(ch->ch_flag & CH_OPOST))
+		return;
+
+	DGRP_TERMIOS_LOCK(tty);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
+	tty->termios->c_oflag |= drp_ocook_flags(ch);
+#else
+	tty->termios.c_oflag |= drp_ocook_flags(ch);
+#endif
+	DGRP_TERMIOS_UNLOCK(tty);
+
+	DGRP_LOCK((ch->ch_nd)->nd_lock, lock_flags);
+
+	ch->ch_flag &= ~CH_OPOST;
+	ch->ch_ocook = 0;
+
+	/* stop the server cooking until drp_param() says otherwise */
+	ch->ch_oflag = 0;
+	ch->ch_flag |= CH_PARAM;
+	(ch->ch_nd)->nd_tx_work = 1;
+
+	DGRP_UNLOCK((ch->ch_nd)->nd_lock, lock_flags);
+}
+
+
 static int dgrp_tty_send_break(struct tty_struct *tty, int msec)
 {
 	struct un_struct *un;
@@ -2897,6 +3292,66 @@ static int dgrp_tty_tiocmget(struct tty_struct *tty)
 }
 
 
+/*
+ * Fill in the TIOCGICOUNT counters.  Modem and line events are counted
+ * by dgrp_receive(); rx and tx are the running data counts.
+ */
+static void drp_get_icount(struct ch_struct *ch,
+			   struct serial_icounter_struct *icount)
+{
+	struct async_icount cnow = ch->ch_icount;
+
+	memset(icount, 0, sizeof(*icount));
+
+	icount->cts         = cnow.cts;
+	icount->dsr         = cnow.dsr;
+	icount->rng         = cnow.rng;
+	icount->dcd         = cnow.dcd;
+	icount->rx          = ch->ch_rxcount;
+	icount->tx          = ch->ch_txcount;
+	icount->frame       = cnow.frame;
+	icount->parity      = cnow.parity;
+	icount->overrun     = cnow.overrun;
+	icount->brk         = cnow.brk;
+	icount->buf_overrun = cnow.buf_overrun;
+}
+
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,39)
+/*
+ * Return the modem/line event counters to the tty core.
+ */
+static int dgrp_tty_get_icount(struct tty_struct *tty,
+			       struct serial_icounter_struct *icount)
+{
+	struct un_struct *un = tty->driver_data;
+
+	if (!un || !un->un_ch)
+		return -ENODEV;
+
+	drp_get_icount(un->un_ch, icount);
+
+	return 0;
+}
+#endif
+
+
+/*
+ * TIOCMIWAIT wakeup condition: one of the signals in mask (TIOCM_RNG,
+ * TIOCM_DSR, TIOCM_CD, TIOCM_CTS) changed since cprev was taken.
+ */
+static int drp_modem_waited(struct ch_struct *ch, unsigned long mask,
+			    struct async_icount *cprev)
+{
+	struct async_icount *cnow = &ch->ch_icount;
+
+	return ((mask & TIOCM_RNG) && cnow->rng != cprev->rng) ||
+	       ((mask & TIOCM_DSR) && cnow->dsr != cprev->dsr) ||
+	       ((mask & TIOCM_CD)  && cnow->dcd != cprev->dcd) ||
+	       ((mask & TIOCM_CTS) && cnow->cts != cprev->cts);
+}
+
+
 /*
  *      Set modem lines
  */
@@ -3284,32 +3739,26 @@ dgrp_tty_ioctl(struct tty_struct *tty, unsigned int cmd, unsigned long arg)
 
 	case TIOCMIWAIT:
 	{
- 	 uchar m,c;
-		/* arg is a value mask of TIOCM_[RNG|DSR|CD|CTS] and the idea is that
-		   if eg. RNG is set, then we wait for our RNG state to change.  I.e.
-		   we are not waiting for RNG to become set, just to change
-     ..i dont _think_ there is need to LOCK around this...
+		struct async_icount cprev = ch->ch_icount;
+
+		/*
+		 * arg is a mask of TIOCM_[RNG|DSR|CD|CTS]: wait for any of
+		 * those signals to change state.  dgrp_receive() counts
+		 * every change and wakes ch_mwait.
 		 */
-	 m = ((ch->ch_s_mlast & ~(DM_RTS|DM_DTR)) | (ch->ch_mout & (DM_RTS|DM_DTR)));
-		for (;;) {
-		 /* wait for something to change : NB: tty_lock not held on IOCTL..
-		  * The monolithic and 'invariant' code in dgrp_net_ops does not issue
-		  * any wakeups on modem changes unless we're waiting for carrier, so
-		  * instead of changing that code, poll.. */
-			msleep (100); /* sleep 1/10 of a second. */
-			if (signal_pending(current))  return -ERESTARTSYS;
-			if (un->un_flag & UN_CLOSING) return -EIO;
-			c = ((ch->ch_s_mlast & ~(DM_RTS|DM_DTR)) | (ch->ch_mout & (DM_RTS|DM_DTR)));
-			if ((c ^= m)) {
-			if (((arg & TIOCM_RNG) && (c & DM_RI))  ||
-			    ((arg & TIOCM_DSR) && (c & DM_DSR)) ||
-			    ((arg & TIOCM_CD)  && (c & DM_CD))  ||
-			    ((arg & TIOCM_CTS) && (c & DM_CTS)))
-				return 0;
-		 }
-	 }
+		rc = wait_event_interruptible(ch->ch_mwait,
+			drp_modem_waited(ch, arg, &cprev) ||
+			(un->un_flag & UN_CLOSING) ||
+			(ch->ch_flag & CH_PORT_GONE) ||
+			test_bit(TTY_IO_ERROR, &tty->flags));
+		if (rc)
+			return -ERESTARTSYS;
+
+		if (!drp_modem_waited(ch, arg, &cprev))
+			return -EIO;
+
+		return 0;
 	}
- break;
 	case TIOCSERGETLSR: 
 	{
 	 unsigned char lsr;
@@ -3445,6 +3894,18 @@ dgrp_tty_ioctl(struct tty_struct *tty, unsigned int cmd, unsigned long arg)
 	case TIOCMSET:
 		return set_modem_info(ch, cmd, (unsigned int *) arg);
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,39)
+	case TIOCGICOUNT:
+	{
+		struct serial_icounter_struct icount;
+
+		drp_get_icount(ch, &icount);
+		if (copy_to_user((void __user *) arg, &icount, sizeof(icount)))
+			return -EFAULT;
+		return 0;
+	}
+#endif
+
 	/*
 	 * Here are any additional ioctl's that we want to implement
 	 */
@@ -3518,45 +3979,78 @@ dgrp_tty_ioctl(struct tty_struct *tty, unsigned int cmd, unsigned long arg)
 	*****************************************/
 
 	case TCGETS:
+#ifdef TCGETS2
+	case TCGETS2:
+#endif
 	case TCGETA:	/* translate our termios to return a termio */
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,31)
 		if (tty->ldisc->ops->ioctl && !IS_PRINT(MINOR(tty_devnum(tty)))) {
 #else
 		if (tty->ldisc.ops->ioctl && !IS_PRINT(MINOR(tty_devnum(tty)))) {
 #endif
+			/*
+			 * Build the user's view in a copy, rather than
+			 * putting the cooked flags back in tty->termios
+			 * while the ldisc reads it.
+			 */
+			struct ktermios kterm;
 			int retval;
 
-			/* take into consideration our cooked output settings */
-			int oflag = _O_FLAG(tty, 0xffff);
+			DGRP_TERMIOS_LOCK(tty);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
-			tty->termios->c_oflag |= ch_to_tty_flags(ch->ch_ocook, 'o');
+			kterm = *tty->termios;
 #else
-			tty->termios.c_oflag |= ch_to_tty_flags(ch->ch_ocook, 'o');
+			kterm = tty->termios;
 #endif
+			DGRP_TERMIOS_UNLOCK(tty);
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,0,0)
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,31)
-			retval = (tty->ldisc->ops->ioctl)(tty, file, cmd, arg);
+			/* take into consideration our cooked output settings */
+			kterm.c_oflag |= drp_ocook_flags(ch);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,2,0)
+			retval = drp_termios_to_user(cmd, (void __user *)arg,
+						     &kterm);
 #else
-			retval = (tty->ldisc.ops->ioctl)(tty, file, cmd, arg);
-#endif
+			if (cmd == TCGETA)
+				retval = kernel_termios_to_user_termio(
+					(struct termio __user *)arg, &kterm);
+#ifdef TCGETS2
+			else if (cmd == TCGETS2)
+				retval = kernel_termios_to_user_termios(
+					(struct termios2 __user *)arg, &kterm);
+			else
+				retval = kernel_termios_to_user_termios_1(
+					(struct termios __user *)arg, &kterm);
 #else
-   retval = -ENOIOCTLCMD; /* so that caller proceeds to the ldisc version */
+			else
+				retval = kernel_termios_to_user_termios(
+					(struct termios __user *)arg, &kterm);
 #endif
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
-			tty->termios->c_oflag = oflag;
-#else
-			tty->termios.c_oflag = oflag;
 #endif
+			if (retval)
+				retval = -EFAULT;
 			return retval;
 
 		}
 		return -ENOIOCTLCMD;
 
+	case TCSETS:
+#ifdef TCSETS2
+	case TCSETS2:
+#endif
+	case TCSETA:
+		if (!IS_PRINT(MINOR(tty_devnum(tty))))
+			drp_ocook_reset(tty, ch);
+		return -ENOIOCTLCMD;
+
 	case TCSETAW:
 	case TCSETAF:
 	case TCSETSF:
 	case TCSETSW:
+#ifdef TCSETS2
+	case TCSETSF2:
+	case TCSETSW2:
+#endif
 		/*
 		 * The linux tty driver doesn't have a flush
 		 * input routine for the driver, assuming all backed
@@ -3597,6 +4091,9 @@ dgrp_tty_ioctl(struct tty_struct *tty, unsigned int cmd, unsigned long arg)
 			ch->ch_rout = ch->ch_rin;
 		}
 
+		if (!IS_PRINT(MINOR(tty_devnum(tty))))
+			drp_ocook_reset(tty, ch);
+
 		/* pretend we didn't recognize this */
 		dbg_tty_trace(IOCTL, ("tty_ioctl - TCSETS[WF] done flushing\n"));
 		return -ENOIOCTLCMD;
@@ -3784,6 +4281,19 @@ static void dgrp_tty_set_termios(struct tty_struct *tty, struct ktermios *old)
 		      MINOR(tty_devnum(tty)), ts->c_cflag, ts->c_oflag,
 		      ts->c_lflag, ts->c_iflag));
 
+	/*
+	 * With OPOST hidden, a termios that got here without going
+	 * through drp_ocook_reset() (tty_set_termios() called inside the
+	 * kernel, TIOCSETP) was built from the view without OPOST and the
+	 * cooked bits.  There is no telling whether its writer cleared
+	 * OPOST on purpose, so take it as it reads and let drp_param()
+	 * start the offload over from it.
+	 */
+	if (un == &ch->ch_tun && (ch->ch_flag & CH_OPOST)) {
+		ch->ch_flag &= ~CH_OPOST;
+		ch->ch_ocook = 0;
+	}
+
 	drp_param(ch);
 
 	/* the CLOCAL flag has just been set */
@@ -4018,6 +4528,9 @@ static void dgrp_tty_hangup(struct tty_struct *tty)
 			wake_up_interruptible(&ch->ch_flag_wait);
 	}
 
+	/* Let TIOCMIWAIT sleepers see the hangup */
+	wake_up_interruptible(&ch->ch_mwait);
+
 	dbg_tty_trace(INPUT, ("dgrp_tty_hangup(%x): done, ch_count(%d)\n",
 		MINOR(tty_devnum(tty)), ch->ch_open_count));
 }
@@ -4048,48 +4561,53 @@ dgrp_tty_uninit(struct nd_struct *nd)
 
 	if (nd->nd_ttdriver_flags & SERIAL_TTDRV_REG) {
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
-		for (i = 0; i < CHAN_MAX; i++) {
+		for (i = 0; i < nd->nd_chan_count; i++) {
 			tty_unregister_device(nd->nd_serial_ttdriver, i);
 		}
 #endif
 		tty_unregister_driver(nd->nd_serial_ttdriver);
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
 		if (nd->nd_serial_ttdriver->ttys) {
 			kfree(nd->nd_serial_ttdriver->ttys);
 			nd->nd_serial_ttdriver->ttys = NULL;
 		}
+#endif
 		put_tty_driver(nd->nd_serial_ttdriver);
 		nd->nd_ttdriver_flags &= ~SERIAL_TTDRV_REG;
 	}
 
 	if (nd->nd_ttdriver_flags & CALLOUT_TTDRV_REG) {
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
-		for (i = 0; i < CHAN_MAX; i++) {
-			tty_unregister_device(nd->nd_callout_ttdriver, i);
-		}
-#endif
+		/*
+		 * No port devices are ever registered on the callout
+		 * driver; see dgrp_chan_count().
+		 */
 		tty_unregister_driver(nd->nd_callout_ttdriver);
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
 		if (nd->nd_callout_ttdriver->ttys) {
 			kfree(nd->nd_callout_ttdriver->ttys);
 			nd->nd_callout_ttdriver->ttys = NULL;
 		}
+#endif
 		put_tty_driver(nd->nd_callout_ttdriver);
 		nd->nd_ttdriver_flags &= ~CALLOUT_TTDRV_REG;
 	}
 
 	if (nd->nd_ttdriver_flags & XPRINT_TTDRV_REG) {
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
-		for (i = 0; i < CHAN_MAX; i++) {
+		for (i = 0; i < nd->nd_chan_count; i++) {
 			tty_unregister_device(nd->nd_xprint_ttdriver, i);
 		}
 #endif
 		tty_unregister_driver(nd->nd_xprint_ttdriver);
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
 		if (nd->nd_xprint_ttdriver->ttys) {
 			kfree(nd->nd_xprint_ttdriver->ttys);
 			nd->nd_xprint_ttdriver->ttys = NULL;
 		}
+#endif
 		put_tty_driver(nd->nd_xprint_ttdriver);
 		nd->nd_ttdriver_flags &= ~XPRINT_TTDRV_REG;
 	}
@@ -4098,6 +4616,25 @@ dgrp_tty_uninit(struct nd_struct *nd)
 }
 
 
+/*
+ *	Allocate a tty driver with room for CHAN_MAX ports.  From 3.7 on
+ *	the tty core allocates the tty_struct pointer table itself, and
+ *	the DYNAMIC_ALLOC flag has to be known at allocation time.
+ */
+static struct tty_driver *dgrp_alloc_ttdriver(unsigned long flags)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
+	return alloc_tty_driver(CHAN_MAX);
+#else
+	struct tty_driver *driver;
+
+	driver = tty_alloc_driver(CHAN_MAX, flags);
+
+	return IS_ERR(driver) ? NULL : driver;
+#endif
+}
+
+
 /*
  *     Initialize the TTY portion of the supplied node.
  */
@@ -4116,7 +4653,9 @@ dgrp_tty_init(struct nd_struct *nd)
 	 *  Initialize the TTDRIVER structures.
 	 */
 
-	nd->nd_serial_ttdriver = alloc_tty_driver(CHAN_MAX);
+	nd->nd_serial_ttdriver = dgrp_alloc_ttdriver(DGRP_TTDRV_FLAGS);
+	if (!nd->nd_serial_ttdriver)
+		return -ENOMEM;
 	sprintf(nd->nd_serial_name,  "tty_dgrp_%s_", id);
 
 	nd->nd_serial_ttdriver->owner        = THIS_MODULE;
@@ -4128,13 +4667,15 @@ dgrp_tty_init(struct nd_struct *nd)
 	nd->nd_serial_ttdriver->subtype      = SERIAL_TYPE_NORMAL;
 	nd->nd_serial_ttdriver->init_termios = DefaultTermios;
 	nd->nd_serial_ttdriver->driver_name  = DRVSTR "(dgrp)";
-	nd->nd_serial_ttdriver->flags        = (TTY_DRIVER_REAL_RAW | TTY_DRIVER_DYNAMIC_DEV | TTY_DRIVER_HARDWARE_BREAK);
+	nd->nd_serial_ttdriver->flags        = DGRP_TTDRV_FLAGS;
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
 	/* The kernel wants space to store pointers to tty_structs. */
 	nd->nd_serial_ttdriver->ttys =
 		dgrp_kzmalloc(CHAN_MAX * sizeof(struct tty_struct *), GFP_KERNEL);
 	if (!nd->nd_serial_ttdriver->ttys)
 		return -ENOMEM;
+#endif
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,28)
 	nd->nd_serial_ttdriver->refcount = nd->nd_tty_ref_cnt;
@@ -4180,7 +4721,9 @@ dgrp_tty_init(struct nd_struct *nd)
 		nd->nd_ttdriver_flags |= SERIAL_TTDRV_REG;
 	}
 
-	nd->nd_callout_ttdriver = alloc_tty_driver(CHAN_MAX);
+	nd->nd_callout_ttdriver = dgrp_alloc_ttdriver(DGRP_CUDRV_FLAGS);
+	if (!nd->nd_callout_ttdriver)
+		return -ENOMEM;
 	sprintf(nd->nd_callout_name, "cu_dgrp_%s_",  id);
 
 	nd->nd_callout_ttdriver->owner        = THIS_MODULE;
@@ -4192,13 +4735,15 @@ dgrp_tty_init(struct nd_struct *nd)
 	nd->nd_callout_ttdriver->subtype      = SERIAL_TYPE_CALLOUT;
 	nd->nd_callout_ttdriver->init_termios = DefaultTermios;
 	nd->nd_callout_ttdriver->driver_name  = DRVSTR "(dgrp)";
-	nd->nd_callout_ttdriver->flags        = (TTY_DRIVER_REAL_RAW | TTY_DRIVER_DYNAMIC_DEV | TTY_DRIVER_HARDWARE_BREAK);
+	nd->nd_callout_ttdriver->flags        = DGRP_CUDRV_FLAGS;
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
 	/* The kernel wants space to store pointers to tty_structs. */
 	nd->nd_callout_ttdriver->ttys =
 		dgrp_kzmalloc(CHAN_MAX * sizeof(struct tty_struct *), GFP_KERNEL);
 	if (!nd->nd_callout_ttdriver->ttys)
 		return -ENOMEM;
+#endif
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,28)
 	nd->nd_callout_ttdriver->refcount = nd->nd_tty_ref_cnt;
@@ -4221,7 +4766,9 @@ dgrp_tty_init(struct nd_struct *nd)
 	}
 
 
-	nd->nd_xprint_ttdriver = alloc_tty_driver(CHAN_MAX);
+	nd->nd_xprint_ttdriver = dgrp_alloc_ttdriver(DGRP_TTDRV_FLAGS);
+	if (!nd->nd_xprint_ttdriver)
+		return -ENOMEM;
 	sprintf(nd->nd_xprint_name,  "pr_dgrp_%s_", id);
 
 	nd->nd_xprint_ttdriver->owner         = THIS_MODULE;
@@ -4233,13 +4780,15 @@ dgrp_tty_init(struct nd_struct *nd)
 	nd->nd_xprint_ttdriver->subtype       = SERIAL_TYPE_XPRINT;
 	nd->nd_xprint_ttdriver->init_termios  = DefaultTermios;
 	nd->nd_xprint_ttdriver->driver_name   = DRVSTR "(dgrp)";
-	nd->nd_xprint_ttdriver->flags         = (TTY_DRIVER_REAL_RAW | TTY_DRIVER_DYNAMIC_DEV | TTY_DRIVER_HARDWARE_BREAK);
+	nd->nd_xprint_ttdriver->flags         = DGRP_TTDRV_FLAGS;
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,7,0)
 	/* The kernel wants space to store pointers to tty_structs. */
 	nd->nd_xprint_ttdriver->ttys =
 		dgrp_kzmalloc(CHAN_MAX * sizeof(struct tty_struct *), GFP_KERNEL);
 	if (!nd->nd_xprint_ttdriver->ttys)
 		return -ENOMEM;
+#endif
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,28)
 	nd->nd_xprint_ttdriver->refcount = nd->nd_tty_ref_cnt;
@@ -4275,8 +4824,20 @@ dgrp_tty_init(struct nd_struct *nd)
 		ch->ch_tun.un_type = SERIAL_TYPE_NORMAL;
 		ch->ch_pun.un_type = SERIAL_TYPE_XPRINT;
 
+		spin_lock_init(&ch->ch_lock);
+
 		init_waitqueue_head(&(ch->ch_flag_wait));
 		init_waitqueue_head(&(ch->ch_sleep));
+		init_waitqueue_head(&(ch->ch_mwait));
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,13,0)
+		hrtimer_init(&ch->ch_cps_timer, CLOCK_MONOTONIC,
+			     HRTIMER_MODE_ABS);
+		ch->ch_cps_timer.function = drp_cps_wakeup;
+#else
+		hrtimer_setup(&ch->ch_cps_timer, drp_cps_wakeup,
+			      CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+#endif
 
 		init_waitqueue_head(&(ch->ch_tun.un_open_wait));
 		init_waitqueue_head(&(ch->ch_tun.un_close_wait));
@@ -4285,6 +4846,7 @@ dgrp_tty_init(struct nd_struct *nd)
 		init_waitqueue_head(&(ch->ch_pun.un_close_wait));
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,7,0)
 		tty_port_init(&ch->port);
+		tty_port_link_device(&ch->port, nd->nd_callout_ttdriver, i);
 #endif
 
 	}
@@ -166,6 +166,9 @@ extern int GLBL(rawreadok);             /* Allow raw writing of input */
 extern int GLBL(register_cudevices);	/* Turn on/off registering legacy cu devices */
 extern int GLBL(register_prdevices);	/* Turn on/off registering transparent print devices */
 extern int GLBL(poll_tick);             /* Poll interval - in ms */
+extern int GLBL(rwin_autotune);		/* Autotune channel receive windows */
+extern int GLBL(mon_size);		/* Monitor buffer size for new opens */
+extern int GLBL(latency);		/* Collect latency histograms */
 
 
 extern spinlock_t (GLBL(poll_lock));   /* Poll scheduling lock */
@@ -248,6 +251,17 @@ int     dgrp_sleep(ulong ticks);
  *-----------------------------------------------------------------------*/
 
 void dgrp_carrier(struct ch_struct *ch);
+void dgrp_tty_pflush(struct ch_struct *ch);
+
+struct vm_area_struct;
+
+struct ring_ctl *dgrp_ring_alloc(int size);
+uchar *dgrp_ring_data(struct ring_ctl *rg);
+int dgrp_ring_mmap(struct ring_ctl *rg, struct vm_area_struct *vma);
+void dgrp_ring_free(struct ring_ctl *rg);
+
+u64 dgrp_lat_now(void);
+void dgrp_lat_end(struct ch_struct *ch, int stage, u64 *stamp, int more);
 
 
 /*-----------------------------------------------------------------------*
@@ -285,6 +299,7 @@ long CHAR_TO_ID(char *s);
 
 extern struct nd_struct *hash_nd_struct[HASHMAX];
 extern struct nd_struct *head_nd_struct;
+extern struct semaphore nd_struct_semaphore;	/* Locks the node list */
 
 void   nd_struct_init(void);
 void   nd_struct_cleanup(void);
@@ -56,7 +56,13 @@
 
 int register_dpa_device(struct nd_struct *, struct proc_dir_entry *);
 int unregister_dpa_device(struct nd_struct *, struct proc_dir_entry *);
-void dgrp_dpa_data(struct nd_struct *, int, uchar *, int);
+void dgrp_dpa_data(struct nd_struct *, int, int, uchar *, int);
+
+/*
+ *  Non-zero if the DPA device is tracing the given port.
+ */
+#define DGRP_DPA_TRACED(nd, port) \
+	((nd)->nd_dpa_debug && test_bit((port), (nd)->nd_dpa_ports))
 
 #endif
 
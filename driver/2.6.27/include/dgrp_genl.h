@@ -0,0 +1,78 @@
+/*
+ * Copyright 2004 Digi International (www.digi.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED; without even the
+ * implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *	NOTE: THIS IS A SHARED HEADER. DO NOT CHANGE CODING STYLE!!!
+ */
+
+#ifndef __DGRP_GENL_H
+#define __DGRP_GENL_H
+
+/*
+ * Generic netlink event stream.  Supervisors join the DGRP_GENL_MCGRP
+ * group of the DGRP_GENL_NAME family and receive one message per event;
+ * nothing has to be polled.
+ */
+
+#define DGRP_GENL_NAME		"dgrp"
+#define DGRP_GENL_VERSION	1
+#define DGRP_GENL_MCGRP		"events"
+
+/*
+ * Event (command) types.  The meaning of DGRP_A_VALUE depends on the
+ * event.
+ */
+enum {
+	DGRP_C_UNSPEC,
+	DGRP_C_CARRIER,		/* Value: new virtual carrier, 0 or 1 */
+	DGRP_C_MODEM,		/* Value: new Realport MLAST */
+	DGRP_C_NODE_STATE,	/* Value: new NS_* state */
+	DGRP_C_PORT_OPEN,	/* Value: 0, or the -errno of a failed open */
+	DGRP_C_PORT_CLOSE,	/* Value: opens remaining on the port */
+	__DGRP_C_MAX,
+};
+#define DGRP_C_MAX	(__DGRP_C_MAX - 1)
+
+/*
+ * Attributes.  All are u32; DGRP_A_PORT is absent from node events.
+ */
+enum {
+	DGRP_A_UNSPEC,
+	DGRP_A_NODE,		/* Node ID, as two characters */
+	DGRP_A_MAJOR,		/* Node's tty major number */
+	DGRP_A_PORT,		/* Port number */
+	DGRP_A_VALUE,		/* Event value, see above */
+	__DGRP_A_MAX,
+};
+#define DGRP_A_MAX	(__DGRP_A_MAX - 1)
+
+#ifdef __KERNEL__
+
+struct nd_struct;
+struct ch_struct;
+
+extern int dgrp_genl_init(void);
+extern void dgrp_genl_uninit(void);
+
+extern void dgrp_genl_carrier(struct ch_struct *ch, int carrier);
+extern void dgrp_genl_modem(struct ch_struct *ch, int mstat);
+extern void dgrp_genl_node_state(struct nd_struct *nd);
+extern void dgrp_genl_open(struct ch_struct *ch, int error);
+extern void dgrp_genl_close(struct ch_struct *ch);
+
+#endif
+
+#endif
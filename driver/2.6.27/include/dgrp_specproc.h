@@ -107,8 +107,8 @@ enum {
  *                              and points to the table which describes the
  *                              entries in the subdirectory
  *
- *    dgrp_proc_handler *read_handler -- When set, points to the fxn which
- *                                       handle outbound data flow
+ *    seq_operations *seq_ops -- When set, points to the seq_file
+ *                               iterator which produces outbound data
  *
  *    dgrp_proc_handler *write_handler -- When set, points to the fxn which
  *                                        handles inbound data flow
@@ -117,9 +117,13 @@ enum {
  *                                 object once registered.  Used to grab
  *                                 the handle of the object for
  *                                 unregistration
+ *
+ *    excl_sem, excl_cnt     -- Keep writers exclusive.  Readers are not
+ *                              counted; each has its own seq_file.
  */
 
 struct dgrp_proc_entry;
+struct seq_operations;
 
 typedef int dgrp_proc_handler (struct dgrp_proc_entry *table, int dir,
 			       struct file *filp, void *buffer,
@@ -130,7 +134,7 @@ struct dgrp_proc_entry {
 	const char        *name;          /* ASCII identifier */
 	mode_t             mode;          /* File access permissions */
 	struct dgrp_proc_entry *child;    /* Child pointer */
-	dgrp_proc_handler *read_handler;  /* Pointer to outbound data fxn */
+	const struct seq_operations *seq_ops; /* Outbound data iterator */
 	dgrp_proc_handler *write_handler; /* Pointer to inbound data fxn */
 	struct proc_dir_entry *de;        /* proc entry pointer */
 	struct semaphore   excl_sem;      /* Protects exclusive access var */
@@ -0,0 +1,285 @@
+/*
+ * Copyright 2004 Digi International (www.digi.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED; without even the
+ * implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Static tracepoints on the driver's hot paths.  They appear under
+ * events/dgrp/ in tracefs and can be used from ftrace, perf or bpftrace.
+ * A disabled tracepoint costs only a patched-out branch.
+ *
+ * dgrp_common.c defines CREATE_TRACE_POINTS before including this file.
+ * Every other user includes it after dgrp_common.h, so that nd_struct
+ * and ch_struct are complete.
+ *
+ * Kernels older than 2.6.32 have no TRACE_EVENT(), so the calls compile
+ * away there.
+ */
+
+#include <linux/version.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,32)
+
+#ifndef __DGRP_TRACE_H
+#define __DGRP_TRACE_H
+
+#define trace_dgrp_send(nd, tmax, len)			do { } while (0)
+#define trace_dgrp_receive(nd, port, cmd, remain)	do { } while (0)
+#define trace_dgrp_rx_data(ch, len)			do { } while (0)
+#define trace_dgrp_input(ch, avail, len)		do { } while (0)
+#define trace_dgrp_rx_error(ch, flag)			do { } while (0)
+#define trace_dgrp_poll_wake(nd)			do { } while (0)
+#define trace_dgrp_node_state(nd)			do { } while (0)
+#define trace_dgrp_open(ch, minor, error)		do { } while (0)
+#define trace_dgrp_close(ch, minor)			do { } while (0)
+
+#endif
+
+#else /* >= 2.6.32 */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dgrp
+
+#if !defined(__DGRP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define __DGRP_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#define show_nd_state(state)					\
+	__print_symbolic(state,					\
+		{ NS_CLOSED,		"CLOSED" },		\
+		{ NS_IDLE,		"IDLE" },		\
+		{ NS_SEND_QUERY,	"SEND_QUERY" },		\
+		{ NS_WAIT_QUERY,	"WAIT_QUERY" },		\
+		{ NS_READY,		"READY" },		\
+		{ NS_SEND_ERROR,	"SEND_ERROR" })
+
+/*
+ * One dgrp_send() sweep: the packet built for the daemon to write.
+ */
+TRACE_EVENT(dgrp_send,
+	TP_PROTO(struct nd_struct *nd, long tmax, int len),
+	TP_ARGS(nd, tmax, len),
+	TP_STRUCT__entry(
+		__field(long,	major)
+		__field(long,	tmax)
+		__field(int,	len)
+		__field(int,	credit)
+		__field(int,	work)
+	),
+	TP_fast_assign(
+		__entry->major	= nd->nd_major;
+		__entry->tmax	= tmax;
+		__entry->len	= len;
+		__entry->credit	= nd->nd_tx_credit;
+		__entry->work	= nd->nd_tx_work;
+	),
+	TP_printk("major=%ld len=%d tmax=%ld credit=%d work=%d",
+		__entry->major, __entry->len, __entry->tmax,
+		__entry->credit, __entry->work)
+);
+
+/*
+ * Each Realport packet dgrp_receive() decodes.  port is -1 for
+ * packets that are not addressed to a port.
+ */
+TRACE_EVENT(dgrp_receive,
+	TP_PROTO(struct nd_struct *nd, int port, int cmd, long remain),
+	TP_ARGS(nd, port, cmd, remain),
+	TP_STRUCT__entry(
+		__field(long,	major)
+		__field(int,	port)
+		__field(int,	cmd)
+		__field(long,	remain)
+	),
+	TP_fast_assign(
+		__entry->major	= nd->nd_major;
+		__entry->port	= port;
+		__entry->cmd	= cmd;
+		__entry->remain	= remain;
+	),
+	TP_printk("major=%ld port=%d cmd=0x%02x remain=%ld",
+		__entry->major, __entry->port, __entry->cmd, __entry->remain)
+);
+
+/*
+ * Receive data accepted into a port's rbuf.
+ */
+TRACE_EVENT(dgrp_rx_data,
+	TP_PROTO(struct ch_struct *ch, int len),
+	TP_ARGS(ch, len),
+	TP_STRUCT__entry(
+		__field(long,	major)
+		__field(int,	port)
+		__field(int,	len)
+		__field(int,	rin)
+		__field(int,	rout)
+	),
+	TP_fast_assign(
+		__entry->major	= ch->ch_nd->nd_major;
+		__entry->port	= ch->ch_portnum;
+		__entry->len	= len;
+		__entry->rin	= ch->ch_rin;
+		__entry->rout	= ch->ch_rout;
+	),
+	TP_printk("major=%ld port=%d len=%d rin=%d rout=%d",
+		__entry->major, __entry->port, __entry->len,
+		__entry->rin, __entry->rout)
+);
+
+/*
+ * A break, framing or parity error decoded from the 0xFF escapes
+ * in the receive data.
+ */
+TRACE_EVENT(dgrp_rx_error,
+	TP_PROTO(struct ch_struct *ch, int flag),
+	TP_ARGS(ch, flag),
+	TP_STRUCT__entry(
+		__field(long,	major)
+		__field(int,	port)
+		__field(int,	flag)
+	),
+	TP_fast_assign(
+		__entry->major	= ch->ch_nd->nd_major;
+		__entry->port	= ch->ch_portnum;
+		__entry->flag	= flag;
+	),
+	TP_printk("major=%ld port=%d error=%s",
+		__entry->major, __entry->port,
+		__print_symbolic(__entry->flag,
+			{ TTY_BREAK,	"BREAK" },
+			{ TTY_FRAME,	"FRAME" },
+			{ TTY_PARITY,	"PARITY" }))
+);
+
+/*
+ * dgrp_input() handing rbuf data to the tty layer.  avail is what was
+ * waiting, len what was delivered.
+ */
+TRACE_EVENT(dgrp_input,
+	TP_PROTO(struct ch_struct *ch, int avail, int len),
+	TP_ARGS(ch, avail, len),
+	TP_STRUCT__entry(
+		__field(long,	major)
+		__field(int,	port)
+		__field(int,	avail)
+		__field(int,	len)
+	),
+	TP_fast_assign(
+		__entry->major	= ch->ch_nd->nd_major;
+		__entry->port	= ch->ch_portnum;
+		__entry->avail	= avail;
+		__entry->len	= len;
+	),
+	TP_printk("major=%ld port=%d avail=%d len=%d",
+		__entry->major, __entry->port, __entry->avail, __entry->len)
+);
+
+/*
+ * The poller waking a node's daemon to transmit.
+ */
+TRACE_EVENT(dgrp_poll_wake,
+	TP_PROTO(struct nd_struct *nd),
+	TP_ARGS(nd),
+	TP_STRUCT__entry(
+		__field(long,	major)
+		__field(int,	credit)
+		__field(int,	work)
+		__field(int,	delay)
+		__field(int,	rate)
+	),
+	TP_fast_assign(
+		__entry->major	= nd->nd_major;
+		__entry->credit	= nd->nd_tx_credit;
+		__entry->work	= nd->nd_tx_work;
+		__entry->delay	= nd->nd_delay;
+		__entry->rate	= nd->nd_rate;
+	),
+	TP_printk("major=%ld credit=%d work=%d delay=%d rate=%d",
+		__entry->major, __entry->credit, __entry->work,
+		__entry->delay, __entry->rate)
+);
+
+/*
+ * A node moving to a new NS_* state.
+ */
+TRACE_EVENT(dgrp_node_state,
+	TP_PROTO(struct nd_struct *nd),
+	TP_ARGS(nd),
+	TP_STRUCT__entry(
+		__field(long,	major)
+		__field(int,	state)
+	),
+	TP_fast_assign(
+		__entry->major	= nd->nd_major;
+		__entry->state	= nd->nd_state;
+	),
+	TP_printk("major=%ld state=%s",
+		__entry->major, show_nd_state(__entry->state))
+);
+
+/*
+ * The end of a tty open, successful or not.
+ */
+TRACE_EVENT(dgrp_open,
+	TP_PROTO(struct ch_struct *ch, int minor, int error),
+	TP_ARGS(ch, minor, error),
+	TP_STRUCT__entry(
+		__field(long,	major)
+		__field(int,	minor)
+		__field(int,	opens)
+		__field(int,	error)
+	),
+	TP_fast_assign(
+		__entry->major	= ch->ch_nd->nd_major;
+		__entry->minor	= minor;
+		__entry->opens	= ch->ch_open_count;
+		__entry->error	= error;
+	),
+	TP_printk("major=%ld minor=%d opens=%d error=%d",
+		__entry->major, __entry->minor, __entry->opens, __entry->error)
+);
+
+/*
+ * The end of a tty close.
+ */
+TRACE_EVENT(dgrp_close,
+	TP_PROTO(struct ch_struct *ch, int minor),
+	TP_ARGS(ch, minor),
+	TP_STRUCT__entry(
+		__field(long,	major)
+		__field(int,	minor)
+		__field(int,	opens)
+	),
+	TP_fast_assign(
+		__entry->major	= ch->ch_nd->nd_major;
+		__entry->minor	= minor;
+		__entry->opens	= ch->ch_open_count;
+	),
+	TP_printk("major=%ld minor=%d opens=%d",
+		__entry->major, __entry->minor, __entry->opens)
+);
+
+#endif /* __DGRP_TRACE_H */
+
+/* This is not a kernel include; look for it on the module's -I path */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE dgrp_trace
+#include <trace/define_trace.h>
+
+#endif /* >= 2.6.32 */
@@ -42,6 +42,10 @@
 #define __DRP_H
 
 #include <linux/types.h>
+#include <linux/list.h>
+#include <linux/bitops.h>
+#include <linux/hrtimer.h>
+#include <linux/serial.h>
 
 #include "digirp.h"
 #include "linux_ver_fix.h"
@@ -52,6 +56,10 @@
 
 #define CHAN_MAX	64		/* Max # ports per server */
 
+#if CHAN_MAX > DIGI_PORTS_MAX
+#error "CHAN_MAX ports do not fit the digirp.h port bitmaps"
+#endif
+
 #define SEQ_MAX		128		/* Max # transmit sequences (2^n) */
 #define SEQ_MASK	(SEQ_MAX-1)	/* Sequence buffer modulus mask */
 
@@ -63,12 +71,19 @@
 
 #define TBUF_LOW	1000		/* Transmit low water mark */
 
+#define PBUF_MAX	64		/* put_char staging buffer size (2^n) */
+#define PBUF_MASK	(PBUF_MAX-1)	/* put_char staging modulus mask */
+
+#define RWIN_MIN	256		/* Smallest autotuned receive window */
+#define RWIN_TUNE_TIME	(HZ / 4)	/* Receive window tuning interval */
+
 #define UIO_BASE	1000		/* Base for write operations */
 #define UIO_MIN		2000		/* Minimum size application buffer */
 #define UIO_MAX		8100		/* Unix I/O buffer size */
 
-#define MON_MAX		65536		/* Monitor buffer size (2^n) */
-#define MON_MASK	(MON_MAX-1)	/* Monitor wrap mask */
+#define MON_MAX		65536		/* Default monitor buffer size */
+#define MON_MIN		4096		/* Smallest monitor buffer size */
+#define MON_LIMIT	(16 << 20)	/* Largest monitor buffer size */
 
 #define DPA_MAX		65536		/* DPA buffer size (2^n) */
 #define DPA_MASK	(DPA_MAX-1)	/* DPA wrap mask */
@@ -78,6 +93,9 @@
 
 #define IDLE_MAX	(20 * HZ)	/* Max TCP link idle time */
 
+#define HOLD_TIME_MAX	1000		/* Max TX coalesce hold time (ms) */
+#define HOLD_BYTES_DEF	1024		/* Default TX coalesce byte target */
+
 #define MAX_DESC_LEN	100		/* Maximum length of stored PS
 					 * description
 					 */
@@ -397,6 +415,36 @@ struct un_struct {
 #define CH_TX_BREAK	0x40000		/* TX Break to be sent,
 					 * but has not yet.
 					 */
+#define CH_OPOST	0x80000		/* Server does all OPOST work,
+					 * OPOST hidden from the ldisc.
+					 */
+
+/************************************************************************
+ * Server batching modes for ch_rx_batch and ch_tx_batch.
+ ************************************************************************/
+
+#define BATCH_STATIC	0		/* Fixed RMAX/RTIME, TMAX/TTIME */
+#define BATCH_ADAPTIVE	1		/* Values follow the traffic */
+
+
+/************************************************************************
+ * Latency histograms, kept per port and per node.
+ *
+ * Bucket 0 counts intervals under 1us, bucket n counts intervals of
+ * [2^(n-1), 2^n) us, and the last bucket everything longer.
+ ************************************************************************/
+
+#define LAT_BUCKETS	24
+
+#define LAT_TX_QUEUE	0		/* drp_wmove() to dgrp_send() */
+#define LAT_TX_ACK	1		/* dgrp_send() sync to server ack */
+#define LAT_RX_PUSH	2		/* dgrp_receive() to flip push */
+#define LAT_MAX		3
+
+struct lat_hist {
+	uint	lh_count[LAT_BUCKETS];
+};
+
 
 /************************************************************************
  * Types of Open Requests for ch_otype.
@@ -443,16 +491,20 @@ struct ch_struct {
 	struct un_struct ch_pun;	/* Printer unit info */
 
 	struct nd_struct *ch_nd;	/* Node pointer */
+	spinlock_t ch_lock;		/* Transmit buffer lock */
 	uchar  *ch_tbuf;		/* Local Transmit Buffer */
 	uchar  *ch_rbuf;		/* Local Receive Buffer */
-	ulong	ch_cpstime;		/* Printer CPS time */
-	ulong	ch_waketime;		/* Printer wake time */
+	uchar	ch_pbuf[PBUF_MAX];	/* put_char staging buffer */
+	ktime_t	ch_cpstime;		/* Printer CPS time */
+	ktime_t	ch_waketime;		/* Printer wake time */
+	struct hrtimer ch_cps_timer;	/* Printer CPS wakeup */
 
 	ulong	ch_flag;		/* CH_* flags */
 
 	ushort	ch_state;		/* CS_* Protocol state */
 	ushort	ch_send;		/* Bit vector of RR_* requests */
 	ushort	ch_expect;		/* Bit vector of RR_* responses */
+	ushort	ch_known;		/* RR_* query results still valid */
 	ushort	ch_wait_carrier;	/* Thread count waiting for carrier */
 	ushort	ch_wait_count[3];	/* Thread count waiting by otype */
 
@@ -467,6 +519,11 @@ struct ch_struct {
 
 	ushort	ch_tin;			/* Local transmit buffer in ptr */
 	ushort	ch_tout;		/* Local transmit buffer out ptr */
+	uchar	ch_pin;			/* put_char staging in ptr */
+	uchar	ch_pout;		/* put_char staging out ptr */
+	uchar	ch_txvec;		/* nd_txvec entries still in ch_tbuf */
+	uchar	ch_tflushed;		/* A flush waits for ch_txvec */
+	ushort	ch_tflush;		/* ch_tout once that flush is done */
 	ushort	ch_s_tin;		/* Realport TIN */
 	ushort	ch_s_tpos;		/* Realport TPOS */
 	ushort	ch_s_tsize;		/* Realport TSIZE */
@@ -504,6 +561,21 @@ struct ch_struct {
 	ushort	ch_s_rlow;		/* Realport RLOW */
 	ushort	ch_s_rhigh;		/* Realport RHIGH */
 
+	ushort	ch_rwin_max;		/* Autotuned receive window limit */
+	int	ch_rwin_rxcount;	/* ch_rxcount at last window tune */
+	ulong	ch_rwin_time;		/* Time of last window tune */
+
+	uchar	ch_rx_batch;		/* BATCH_* receive batching mode */
+	int	ch_rx_avg;		/* Receive packet size average * 8 */
+	uchar	ch_tx_batch;		/* BATCH_* transmit batching mode */
+	int	ch_tx_avg;		/* Write size average * 8 */
+	ushort	ch_tx_tmax;		/* TMAX wanted by drp_tx_batch() */
+	ushort	ch_tx_ttime;		/* TTIME wanted by drp_tx_batch() */
+
+	u64	ch_lat_tx;		/* Oldest unsent TX data time (ns) */
+	u64	ch_lat_rx;		/* Oldest undelivered RX data time */
+	struct lat_hist ch_lat[LAT_MAX]; /* LAT_* latency histograms */
+
 	ushort	ch_brate;		/* Local baud rate */
 	ushort	ch_cflag;		/* Local tty cflags */
 	ushort	ch_iflag;		/* Local tty iflags */
@@ -543,6 +615,9 @@ struct ch_struct {
 
 	wait_queue_head_t ch_flag_wait;	/* Wait queue for ch_flag changes */
 	wait_queue_head_t ch_sleep;	/* Wait queue for my_sleep() */
+	wait_queue_head_t ch_mwait;	/* Wait queue for modem changes */
+
+	struct async_icount ch_icount;	/* Modem/line event counters */
 
 	int	ch_custom_speed;	/* Realport custom speed */
 	int	ch_txcount;		/* Running TX count */
@@ -577,13 +652,6 @@ struct ch_struct {
 #define ND_DEB_WAIT	0x0002		/* Debug Device waiting */
 
 
-/************************************************************************
- * Monitoring flag definitions.
- ************************************************************************/
-
-#define MON_WAIT_DATA	0x0001		/* Waiting for buffer data */
-#define MON_WAIT_SPACE	0x0002		/* Waiting for buffer space */
-
 /************************************************************************
  * DPA flag definitions.
  ************************************************************************/
@@ -622,6 +690,49 @@ struct ch_struct {
 #define XPRINT_TTDRV_REG   0x0004     /* nd_xprint_ttdriver registered  */
 
 
+/************************************************************************
+ * Transmit data vector.  dgrp_send() leaves transmit data in ch_tbuf
+ * and records where it belongs in the packet; dgrp_net_read() copies
+ * it straight from ch_tbuf to the daemon and then releases the space
+ * by moving ch_tout on to tv_tout.  A flush in between only records
+ * where ch_tout should go (ch_tflush), and is applied once the last
+ * piece of the channel has been copied.
+ ************************************************************************/
+
+#define TXVEC_MAX	(2 * CHAN_MAX)	/* Up to 2 tbuf pieces per port */
+
+struct txvec_struct {
+	struct ch_struct *tv_ch;	/* Channel owning the data */
+	ushort	tv_off;			/* Packet header offset it follows */
+	ushort	tv_pos;			/* Start in ch_tbuf */
+	ushort	tv_len;			/* Length in ch_tbuf */
+	ushort	tv_tout;		/* ch_tout once it is copied */
+};
+
+
+/************************************************************************
+ * Monitor reader.  There is one of these for each open of
+ * /proc/dgrp/mon/ID, each with its own ring and filter.
+ ************************************************************************/
+
+struct mon_struct {
+	struct list_head mon_list;	/* On the node's nd_mon_list */
+	struct nd_struct *mon_nd;	/* Node being monitored */
+	struct ring_ctl *mon_ctl;	/* Ring control page (mappable) */
+	uchar	*mon_buf;		/* Ring buffer, after mon_ctl */
+	int	mon_size;		/* Ring size (2^n) */
+	ulong	mon_lbolt;		/* Open time, for record stamps */
+	ulong	mon_lost;		/* Records dropped, not yet noted */
+	ulong	mon_drops;		/* Records dropped since open */
+	ulong	mon_drop_bytes;		/* Bytes dropped since open */
+	uint	mon_flags;		/* MF_* classes recorded */
+	int	mon_portsel;		/* Non-zero if mon_ports is a subset */
+	DECLARE_BITMAP(mon_ports, CHAN_MAX); /* Ports recorded */
+	struct semaphore mon_semaphore;	/* Serialises readers */
+	wait_queue_head_t mon_wqueue;	/* Wait queue for data */
+};
+
+
 /************************************************************************
  * Node structure.  There exists one of these for each associated
  * realport server.
@@ -650,12 +761,8 @@ struct nd_struct {
 	spinlock_t nd_lock;               /* General node lock             */
 
 	struct semaphore nd_net_semaphore; /* Net read/write lock           */
-	struct semaphore nd_mon_semaphore; /* Monitor buffer lock           */
 	spinlock_t nd_dpa_lock;	   	/* DPA buffer lock           */
 
-	struct semaphore nd_ports_semaphore; /* /proc/dgrp/ports exclusivity  */
-	int           nd_ports_inuse;      /* use count protected by sema.  */
-
 	int           nd_state;            /* NS_* network state            */
 	int           nd_chan_count;       /* # active channels             */
 	int           nd_flag;             /* Node flags                    */
@@ -663,6 +770,9 @@ struct nd_struct {
 	int           nd_expect;           /* Responses we expect           */
 
 	uchar       *nd_iobuf;            /* Network R/W Buffer            */
+	struct txvec_struct nd_txvec[TXVEC_MAX]; /* tbuf data in packet */
+	int           nd_txvec_count;      /* # entries in nd_txvec         */
+	int           nd_txvec_len;        /* Bytes described by nd_txvec   */
 	wait_queue_head_t nd_tx_waitq;    /* Network select wait queue     */
 
 	uchar       *nd_inputbuf;         /* Input Buffer                  */
@@ -680,6 +790,11 @@ struct nd_struct {
 	int           nd_rate;             /* Current TX rate               */
 	link_t        nd_link;             /* Link speed params.            */
 
+	int           nd_hold_time;        /* TX coalesce max hold (ms)     */
+	int           nd_hold_bytes;       /* TX coalesce byte target       */
+	int           nd_hold_flag;        /* TX data is being held         */
+	ulong        nd_hold_start;       /* Time TX data was first held   */
+
 	int           nd_seq_in;           /* TX seq in ptr                 */
 	int           nd_seq_out;          /* TX seq out ptr                */
 	int           nd_unack;            /* Unacknowledged byte count     */
@@ -694,28 +809,34 @@ struct nd_struct {
 	int           nd_tx_byte;          /* Transmit byte count           */
 	int           nd_rx_byte;          /* Receive byte count            */
 
-	ulong        nd_mon_lbolt;       /* Monitor start time             */
-	int           nd_mon_flag;        /* Monitor flags                  */
-	int           nd_mon_in;          /* Monitor in pointer             */
-	int           nd_mon_out;         /* Monitor out pointer            */
-	wait_queue_head_t nd_mon_wqueue;  /* Monitor wait queue (on flags)  */
-	uchar       *nd_mon_buf;         /* Monitor buffer                 */
+	struct list_head nd_mon_list;     /* Open monitor readers           */
+	int           nd_mon_count;       /* Number of monitor readers      */
+	int           nd_mon_portsel;     /* Readers filtering on ports     */
+	DECLARE_BITMAP(nd_mon_ports, CHAN_MAX); /* Ports in packet being built */
+	uchar       *nd_mon_stage;       /* Received data awaiting record  */
+	ulong         nd_mon_drops;       /* Records dropped, all readers   */
+	ulong         nd_mon_drop_bytes;  /* Bytes dropped, all readers     */
 
 	ulong        nd_dpa_lbolt;	/* DPA start time             */
 	int          nd_dpa_flag;	/* DPA flags                  */
-	int          nd_dpa_in;		/* DPA in pointer             */
-	int          nd_dpa_out;	/* DPA out pointer            */
 	wait_queue_head_t nd_dpa_wqueue; /* DPA wait queue (on flags)  */
-	uchar        *nd_dpa_buf;	/* DPA buffer                 */
+	struct ring_ctl *nd_dpa_ctl;	/* DPA control page (mappable) */
+	uchar        *nd_dpa_buf;	/* DPA buffer, after nd_dpa_ctl */
 
 	uint	     nd_dpa_debug;
-	uint	     nd_dpa_port;
+	uint	     nd_dpa_mode;	/* DPA_MODE_* flags           */
+	DECLARE_BITMAP(nd_dpa_ports, CHAN_MAX); /* Ports being traced  */
+	ulong        nd_dpa_drops;	/* DPA packets dropped        */
+	ulong        nd_dpa_drop_bytes;	/* DPA bytes dropped          */
 
 	wait_queue_head_t nd_seq_wque[SEQ_MAX];   /* TX thread wait queues */
 	uchar        nd_seq_wait[SEQ_MAX];   /* Transmit thread wait count */
 
 	ushort       nd_seq_size[SEQ_MAX];   /* Transmit seq packet size   */
 	ulong        nd_seq_time[SEQ_MAX];   /* Transmit seq packet time   */
+	u64          nd_seq_stamp[SEQ_MAX];  /* Transmit seq time (ns)     */
+
+	struct lat_hist nd_lat[LAT_MAX];     /* LAT_* latency, all ports   */
 
 	ushort       nd_hw_ver;           /* HW version returned from PS   */
 	ushort       nd_sw_ver;           /* SW version returned from PS   */
@@ -746,6 +867,7 @@ struct nd_struct {
  * Defines to keep track of time and to manage the poller.
  ************************************************************************/
 #define TimeGE(a, b) ((long) ((a) - (b)) >= 0)
+#define KtimeGE(a, b) (ktime_to_ns(ktime_sub((a), (b))) >= 0)
 #define dgrp_jiffies_from_ms(a) (((a) * HZ) / 1000)
 
 extern ulong drp_poll_time;		/* Time of next poll */
@@ -97,6 +97,14 @@
 #define DGRP_LOCK(x, y)		spin_lock_irqsave(&(x), y)
 #define DGRP_UNLOCK(x, y)	spin_unlock_irqrestore(&(x), y)
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,12,0)
+#define DGRP_TERMIOS_LOCK(tty)		mutex_lock(&(tty)->termios_mutex)
+#define DGRP_TERMIOS_UNLOCK(tty)	mutex_unlock(&(tty)->termios_mutex)
+#else
+#define DGRP_TERMIOS_LOCK(tty)		down_write(&(tty)->termios_rwsem)
+#define DGRP_TERMIOS_UNLOCK(tty)	up_write(&(tty)->termios_rwsem)
+#endif
+
 
 /*
  *	Additional types needed by header files